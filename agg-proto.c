@@ -0,0 +1,254 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+#include <ccan/endian/endian.h>
+
+#include <penny/math.h>
+
+#include "agg-proto.h"
+
+void agg_record_encode(const struct agg_sample *s, struct agg_record *r)
+{
+	memset(r, 0, sizeof(*r));
+	r->offset = cpu_to_be32(s->offset);
+	r->domain = s->domain;
+	r->kind = s->kind;
+	r->index = cpu_to_be16(s->index);
+	r->lpar = cpu_to_be16(s->lpar);
+	r->count = cpu_to_be32(s->count);
+	r->timebase = cpu_to_be64(s->timebase);
+	r->value = cpu_to_be64(s->value);
+}
+
+void agg_record_decode(const struct agg_record *r, struct agg_sample *s)
+{
+	s->offset = be32_to_cpu(r->offset);
+	s->domain = r->domain;
+	s->kind = r->kind;
+	s->index = be16_to_cpu(r->index);
+	s->lpar = be16_to_cpu(r->lpar);
+	s->count = be32_to_cpu(r->count);
+	s->timebase = be64_to_cpu(r->timebase);
+	s->value = be64_to_cpu(r->value);
+}
+
+static int sockaddr_fill(struct sockaddr_un *a, const char *path)
+{
+	memset(a, 0, sizeof(*a));
+	a->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(a->sun_path)) {
+		warnx("socket path too long: %s", path);
+		return -1;
+	}
+	strcpy(a->sun_path, path);
+	return 0;
+}
+
+int agg_listen(const char *path)
+{
+	struct sockaddr_un a;
+	if (sockaddr_fill(&a, path))
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		warn("socket");
+		return -1;
+	}
+
+	/* a stale socket from a previous run */
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&a, sizeof(a)) || listen(fd, 64)) {
+		warn("could not listen on %s", path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int agg_connect(const char *path)
+{
+	struct sockaddr_un a;
+	if (sockaddr_fill(&a, path))
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		warn("socket");
+		return -1;
+	}
+
+	if (connect(fd, (struct sockaddr *)&a, sizeof(a))) {
+		warn("could not connect to %s", path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int send_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	while (len) {
+		ssize_t r = send(fd, p, len, MSG_NOSIGNAL);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+struct agg_msg {
+	struct agg_msg_header h;
+	struct agg_record r[AGG_BATCH_MAX];
+} __attribute__((__packed__));
+
+/* @c is at most AGG_BATCH_MAX. Returns the length of the message */
+static size_t msg_encode(struct agg_msg *m, unsigned type, const struct agg_sample *s, size_t c)
+{
+	size_t i;
+
+	memset(&m->h, 0, sizeof(m->h));
+	m->h.magic = cpu_to_be32(AGG_MAGIC);
+	m->h.version = AGG_PROTO_VERSION;
+	m->h.type = type;
+	m->h.count = cpu_to_be32(c);
+	for (i = 0; i < c; i++)
+		agg_record_encode(&s[i], &m->r[i]);
+
+	return sizeof(m->h) + c * sizeof(m->r[0]);
+}
+
+size_t agg_encode(unsigned type, const struct agg_sample *s, size_t n,
+		unsigned char **buf, size_t *alloc)
+{
+	size_t msgs = n ? (n + AGG_BATCH_MAX - 1) / AGG_BATCH_MAX : 1;
+	size_t need = msgs * sizeof(struct agg_msg_header) + n * sizeof(struct agg_record);
+	size_t len = 0;
+
+	if (need > *alloc) {
+		*buf = realloc(*buf, need);
+		if (!*buf)
+			err(1, "alloc failure");
+		*alloc = need;
+	}
+
+	do {
+		size_t c = min(n, (size_t)AGG_BATCH_MAX);
+		len += msg_encode((struct agg_msg *)(*buf + len), type, s, c);
+		s += c;
+		n -= c;
+	} while (n);
+
+	return len;
+}
+
+int agg_send(int fd, unsigned type, const struct agg_sample *s, size_t n)
+{
+	struct agg_msg *m = malloc(sizeof(*m));
+	int ret = 0;
+
+	if (!m)
+		err(1, "alloc failure");
+
+	do {
+		size_t c = min(n, (size_t)AGG_BATCH_MAX);
+
+		if (send_all(fd, m, msg_encode(m, type, s, c))) {
+			ret = -1;
+			break;
+		}
+
+		s += c;
+		n -= c;
+	} while (n);
+
+	free(m);
+	return ret;
+}
+
+void agg_reader_init(struct agg_reader *r)
+{
+	r->cap = sizeof(struct agg_msg_header) + AGG_BATCH_MAX * sizeof(struct agg_record);
+	r->buf = malloc(r->cap);
+	if (!r->buf)
+		err(1, "alloc failure");
+	r->pos = 0;
+	r->len = 0;
+}
+
+void agg_reader_free(struct agg_reader *r)
+{
+	free(r->buf);
+}
+
+ssize_t agg_reader_fill(struct agg_reader *r, int fd)
+{
+	/* the buffer always has room for one whole message */
+	if (r->pos) {
+		memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+		r->len -= r->pos;
+		r->pos = 0;
+	}
+
+	ssize_t n;
+	do {
+		n = read(fd, r->buf + r->len, r->cap - r->len);
+	} while (n < 0 && errno == EINTR);
+
+	if (n > 0)
+		r->len += n;
+	return n;
+}
+
+int agg_reader_next(struct agg_reader *r, unsigned *type,
+		const struct agg_record **records, size_t *count)
+{
+	struct agg_msg_header h;
+	size_t avail = r->len - r->pos;
+
+	if (avail < sizeof(h))
+		return 0;
+
+	memcpy(&h, r->buf + r->pos, sizeof(h));
+	size_t n = be32_to_cpu(h.count);
+	if (be32_to_cpu(h.magic) != AGG_MAGIC || h.version != AGG_PROTO_VERSION ||
+			n > AGG_BATCH_MAX) {
+		pr_debug(1, "bad message header (magic %08x, version %u, count %zu)",
+				be32_to_cpu(h.magic), h.version, n);
+		return -1;
+	}
+
+	size_t len = sizeof(h) + n * sizeof(struct agg_record);
+	if (avail < len)
+		return 0;
+
+	*type = h.type;
+	*records = (const void *)(r->buf + r->pos + sizeof(h));
+	*count = n;
+	r->pos += len;
+	return 1;
+}
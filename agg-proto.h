@@ -0,0 +1,128 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef AGG_PROTO_H_
+#define AGG_PROTO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Sample batches exchanged with the aggregator over a unix stream socket.
+ *
+ * Collectors send AGG_MSG_SAMPLES messages of raw samples: counter values
+ * as read, which the aggregator turns into deltas itself, so collectors
+ * reading the same counter at different intervals don't count anything
+ * twice. A client that sends AGG_MSG_SUBSCRIBE instead gets AGG_MSG_SAMPLES
+ * messages back, holding the aggregator's rollups (the same records, with
+ * @kind saying what was rolled up).
+ *
+ * Everything on the wire is big endian.
+ *
+ * Message:
+ *	struct agg_msg_header
+ *	struct agg_record[count]
+ */
+
+#define AGG_MAGIC 0x32344147 /* "24AG" */
+#define AGG_PROTO_VERSION 1
+/* records in one message */
+#define AGG_BATCH_MAX 4096
+
+enum agg_msg_type {
+	AGG_MSG_SAMPLES = 1,
+	AGG_MSG_SUBSCRIBE = 2,
+};
+
+enum agg_kind {
+	/* a single counter read by a collector */
+	AGG_KIND_SAMPLE = 1,
+	/* rollups: physical chip, physical core, and all vcpus of an lpar */
+	AGG_KIND_CHIP = 2,
+	AGG_KIND_CORE = 3,
+	AGG_KIND_LPAR = 4,
+};
+
+struct agg_msg_header {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t type;
+	uint8_t reserved[2];
+	uint32_t count;
+	uint8_t reserved2[4];
+} __attribute__((__packed__));
+
+struct agg_record {
+	/* event identity */
+	uint32_t offset;
+	uint8_t domain;
+
+	uint8_t kind;
+	/* chip, core or vcpu for samples, the chip, core or lpar for rollups */
+	uint16_t index;
+	uint16_t lpar;
+	uint8_t reserved[2];
+
+	/* samples rolled up, 1 for a single sample */
+	uint32_t count;
+	/* of the sample, or of the latest sample rolled up */
+	uint64_t timebase;
+	/* the counter's value, or the sum of its deltas for rollups */
+	uint64_t value;
+} __attribute__((__packed__));
+
+/* host order version of struct agg_record */
+struct agg_sample {
+	unsigned kind;
+	unsigned domain;
+	uint32_t offset;
+	uint16_t index;
+	uint16_t lpar;
+	uint32_t count;
+	uint64_t timebase;
+	uint64_t value;
+};
+
+void agg_record_encode(const struct agg_sample *s, struct agg_record *r);
+void agg_record_decode(const struct agg_record *r, struct agg_sample *s);
+
+int agg_listen(const char *path);
+int agg_connect(const char *path);
+
+/* Sends @n samples as one or more messages */
+int agg_send(int fd, unsigned type, const struct agg_sample *s, size_t n);
+
+/*
+ * Encodes @n samples as one or more messages into *@buf, growing it (and
+ * *@alloc) as needed. Returns the length of the messages.
+ */
+size_t agg_encode(unsigned type, const struct agg_sample *s, size_t n,
+		unsigned char **buf, size_t *alloc);
+
+/* Reassembles messages from a stream */
+struct agg_reader {
+	unsigned char *buf;
+	size_t pos, len, cap;
+};
+
+void agg_reader_init(struct agg_reader *r);
+void agg_reader_free(struct agg_reader *r);
+
+/* read() once. Returns the number of bytes read, 0 at EOF, -1 on error */
+ssize_t agg_reader_fill(struct agg_reader *r, int fd);
+
+/*
+ * Returns 1 and the next complete message, 0 if more data is needed, or -1
+ * if the stream is not speaking this protocol. @records remain valid until
+ * the next agg_reader_fill().
+ */
+int agg_reader_next(struct agg_reader *r, unsigned *type,
+		const struct agg_record **records, size_t *count);
+
+#endif
@@ -0,0 +1,345 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/*
+ * Run the sample aggregator, fake collectors to feed it, or a subscriber to
+ * print what it publishes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/err/err.h>
+
+#include "catalog.h"
+#include "agg-proto.h"
+#include "aggregator.h"
+
+static void _usage(const char *p, int e)
+{
+	FILE *o = stderr;
+	fprintf(o,
+"usage: %s daemon [-j workers] [-i interval_ms] [-t seconds] [-d slots] <socket>\n"
+"       %s fake [-c collectors] [-n batches] [-k cores] [-v vcpus] [-e events] <socket>\n"
+"       %s subscribe [-q] <socket>\n"
+"\n"
+"fake collectors each read the same physical core counters and the vcpu\n"
+"counters of their own lpar, collector N every N+1 seconds of timebase, and\n"
+"send their raw values. Every counter counts one a second. subscribe prints\n"
+"rollups until the aggregator goes away, then their totals.\n", p, p, p);
+	exit(e);
+}
+
+#define _PRGM_NAME "hv-agg"
+#define PRGM_NAME  (argc?argv[0]:_PRGM_NAME)
+#define usage(argc, argv, e) _usage(PRGM_NAME, e)
+#define U(e) usage(argc, argv, e)
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static int cmd_daemon(int argc, char **argv)
+{
+	unsigned workers = sysconf(_SC_NPROCESSORS_ONLN), interval_ms = 1000;
+	size_t counter_slots = 1 << 20;
+	long seconds = 0, elapsed;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:i:t:d:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			workers = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtol(optarg, NULL, 0);
+			break;
+		case 'd':
+			counter_slots = strtoull(optarg, NULL, 0);
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (argc - optind != 1 || !interval_ms)
+		U(1);
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	struct aggregator *a = aggregator_start(argv[optind], workers, interval_ms, counter_slots);
+	if (!a)
+		return 1;
+
+	for (elapsed = 0; !stop && (!seconds || elapsed < seconds); elapsed++)
+		sleep(1);
+
+	struct aggregator_stats st;
+	aggregator_stop(a, &st);
+	fprintf(stderr,
+		"%"PRIu64" samples received, %"PRIu64" duplicates, %"PRIu64" first, %"PRIu64" invalid, %"PRIu64" untracked\n"
+		"%"PRIu64" rollups published over %"PRIu64" intervals, %"PRIu64" slow subscribers dropped\n",
+		st.received, st.duplicates, st.first, st.invalid, st.untracked,
+		st.published, st.intervals, st.slow_subscribers);
+	return 0;
+}
+
+struct fake_collector {
+	pthread_t thread;
+	const char *path;
+	unsigned id;
+	unsigned batches, cores, vcpus, events;
+	uint64_t sent;
+};
+
+static void *fake_collector(void *arg)
+{
+	struct fake_collector *f = arg;
+	size_t n = (size_t)(f->cores + f->vcpus) * f->events, i;
+	struct agg_sample *s = calloc(n, sizeof(*s));
+	unsigned b, ix, e;
+
+	if (!s)
+		err(1, "alloc failure");
+
+	int fd = agg_connect(f->path);
+	if (fd == -1)
+		exit(1);
+
+	for (b = 0; b < f->batches; b++) {
+		/* every lpar starts at 0, each at its own period */
+		uint64_t seconds = (uint64_t)b * (f->id + 1);
+		uint64_t timebase = seconds * 512000000;
+
+		for (i = 0, e = 0; e < f->events; e++) {
+			for (ix = 0; ix < f->cores; ix++)
+				s[i++] = (struct agg_sample) {
+					.kind = AGG_KIND_SAMPLE,
+					.domain = HV_PERF_DOMAIN_PHYSICAL_CORE,
+					.offset = 0x100 + e * 8,
+					.index = ix,
+					.count = 1,
+					.timebase = timebase,
+					.value = ((uint64_t)e << 32 | ix) + seconds,
+				};
+			for (ix = 0; ix < f->vcpus; ix++)
+				s[i++] = (struct agg_sample) {
+					.kind = AGG_KIND_SAMPLE,
+					.domain = HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_HOME_CORE,
+					.offset = 0x100 + e * 8,
+					.index = ix,
+					.lpar = f->id,
+					.count = 1,
+					.timebase = timebase,
+					.value = ((uint64_t)e << 32 | ix) + seconds,
+				};
+		}
+
+		if (agg_send(fd, AGG_MSG_SAMPLES, s, n))
+			err(1, "collector %u: send failure", f->id);
+		f->sent += n;
+	}
+
+	close(fd);
+	free(s);
+	return NULL;
+}
+
+static int cmd_fake(int argc, char **argv)
+{
+	unsigned collectors = 4, batches = 100, cores = 16, vcpus = 8, events = 32, i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:n:k:v:e:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			collectors = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			batches = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			cores = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			vcpus = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			events = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (argc - optind != 1 || cores > UINT16_MAX + 1 || vcpus > UINT16_MAX + 1 ||
+			collectors > UINT16_MAX + 1)
+		U(1);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	struct fake_collector *f = calloc(collectors, sizeof(*f));
+	if (!f && collectors)
+		err(1, "alloc failure");
+
+	for (i = 0; i < collectors; i++) {
+		f[i] = (struct fake_collector) {
+			.path = argv[optind],
+			.id = i,
+			.batches = batches,
+			.cores = cores,
+			.vcpus = vcpus,
+			.events = events,
+		};
+		int r = pthread_create(&f[i].thread, NULL, fake_collector, &f[i]);
+		if (r) {
+			errno = r;
+			err(1, "could not create collector thread");
+		}
+	}
+
+	uint64_t sent = 0;
+	for (i = 0; i < collectors; i++) {
+		pthread_join(f[i].thread, NULL);
+		sent += f[i].sent;
+	}
+
+	/*
+	 * Deltas add up to the seconds between a counter's first sample (at 0)
+	 * and its latest: the slowest collector's last for the core counters.
+	 */
+	uint64_t seconds = batches && collectors ? (uint64_t)(batches - 1) * collectors : 0;
+	uint64_t lpar_seconds = batches ? (uint64_t)(batches - 1) * collectors * (collectors + 1) / 2 : 0;
+	printf("%"PRIu64" samples sent, expect %"PRIu64" first samples\n"
+		"expect core rollups to total %"PRIu64", lpar rollups %"PRIu64"\n",
+		sent, batches && collectors ? (uint64_t)(cores + (uint64_t)collectors * vcpus) * events : 0,
+		seconds * cores * events, lpar_seconds * vcpus * events);
+
+	free(f);
+	return 0;
+}
+
+static const char *kind_name(unsigned kind)
+{
+	static const char *names[] = {
+		[AGG_KIND_SAMPLE] = "sample",
+		[AGG_KIND_CHIP] = "chip",
+		[AGG_KIND_CORE] = "core",
+		[AGG_KIND_LPAR] = "lpar",
+	};
+	if (kind < ARRAY_SIZE(names) && names[kind])
+		return names[kind];
+	return "unknown";
+}
+
+static int cmd_subscribe(int argc, char **argv)
+{
+	uint64_t totals[AGG_KIND_LPAR + 1] = { 0 }, rollups[AGG_KIND_LPAR + 1] = { 0 };
+	const struct agg_record *records;
+	struct agg_reader r;
+	bool quiet = false;
+	unsigned type, k;
+	size_t n, i;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "qh")) != -1) {
+		switch (opt) {
+		case 'q':
+			quiet = true;
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (argc - optind != 1)
+		U(1);
+
+	int fd = agg_connect(argv[optind]);
+	if (fd == -1)
+		return 1;
+	if (agg_send(fd, AGG_MSG_SUBSCRIBE, NULL, 0))
+		err(1, "could not subscribe");
+
+	agg_reader_init(&r);
+	while (agg_reader_fill(&r, fd) > 0) {
+		while ((ret = agg_reader_next(&r, &type, &records, &n)) == 1) {
+			for (i = 0; i < n; i++) {
+				struct agg_sample s;
+				agg_record_decode(&records[i], &s);
+				if (s.kind <= AGG_KIND_LPAR) {
+					totals[s.kind] += s.value;
+					rollups[s.kind]++;
+				}
+				if (!quiet)
+					printf("%s %u domain=0x%x,offset=0x%"PRIx32" count=%"PRIu32" value=%"PRIu64" timebase=%"PRIu64"\n",
+							kind_name(s.kind), s.index, s.domain, s.offset,
+							s.count, s.value, s.timebase);
+			}
+		}
+		if (ret < 0)
+			errx(1, "malformed message from the aggregator");
+	}
+
+	for (k = AGG_KIND_CHIP; k <= AGG_KIND_LPAR; k++)
+		printf("%s: %"PRIu64" rollups, total %"PRIu64"\n",
+				kind_name(k), rollups[k], totals[k]);
+
+	agg_reader_free(&r);
+	close(fd);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	err_set_progname(PRGM_NAME);
+
+	if (argc < 2)
+		U(1);
+
+	/* let each command's getopt see its own options */
+	const char *cmd = argv[1];
+	argv[1] = argv[0];
+	argc--;
+	argv++;
+
+	if (!strcmp(cmd, "daemon"))
+		return cmd_daemon(argc, argv);
+	if (!strcmp(cmd, "fake"))
+		return cmd_fake(argc, argv);
+	if (!strcmp(cmd, "subscribe"))
+		return cmd_subscribe(argc, argv);
+	if (!strcmp(cmd, "-h"))
+		U(0);
+	U(1);
+}
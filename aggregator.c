@@ -0,0 +1,814 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+
+#include "catalog.h"
+#include "aggregator.h"
+
+struct rollup {
+	/* 0 for an empty slot */
+	uint64_t key;
+	uint64_t value;
+	uint64_t timebase;
+	uint32_t count;
+};
+
+/* open addressing, only ever used by one thread at a time */
+struct rollup_table {
+	struct rollup *slots;
+	size_t size, used;
+};
+
+typedef unsigned __int128 u128;
+
+/*
+ * Both halves are replaced whole, with 16 byte compare and swaps, so the
+ * timebase and value of a counter always go together.
+ */
+struct counter_slot {
+	/* counter key in the low half, lpar in the high one, 0 when empty */
+	u128 key;
+	/* latest timebase + 1 in the high half, 0 if none yet, its value in the low one */
+	u128 latest;
+} __attribute__((aligned(16)));
+
+/* Intervals of rollups a subscriber may fall behind before it is dropped */
+#define SUBSCRIBER_BACKLOG 4
+
+struct agg_msg_buf {
+	unsigned char *buf;
+	size_t len, alloc;
+};
+
+struct agg_subscriber {
+	int fd;
+	/* the message it is being sent, and how much of it it has been */
+	uint64_t seq;
+	size_t sent;
+};
+
+struct agg_conn {
+	int fd;
+	struct agg_reader r;
+};
+
+struct agg_worker {
+	struct aggregator *a;
+	pthread_t thread;
+	/* new connections (fds) and wakeups (-1) */
+	int wake[2];
+
+	struct agg_conn *conns;
+	size_t conn_count;
+
+	struct rollup_table shards[2];
+	/* the shard the worker should use, set by the publisher */
+	unsigned active;
+	/* the shard the worker is using */
+	unsigned acked;
+
+	/* written by the worker only */
+	uint64_t received, duplicates, first, invalid, untracked;
+} __attribute__((aligned(64)));
+
+struct aggregator {
+	char *path;
+	int listen_fd;
+	unsigned interval_ms;
+
+	struct agg_worker *workers;
+	unsigned worker_count;
+	bool stop;
+
+	/* workers signal @acked changing */
+	pthread_mutex_t ack_lock;
+	pthread_cond_t ack_cond;
+
+	/* shared by all workers, lock free */
+	struct counter_slot *counters;
+	size_t counter_size;
+
+	pthread_t thread;
+	int stop_pipe[2];
+
+	/* publisher only */
+	struct rollup_table merged;
+	struct agg_sample *out;
+	size_t out_alloc;
+	struct pollfd *fds;
+	size_t fds_alloc;
+
+	/*
+	 * Only the publisher sends to subscribers, without blocking, as fast as
+	 * they take the last SUBSCRIBER_BACKLOG intervals' rollups: message
+	 * @seq is @msgs[@seq % SUBSCRIBER_BACKLOG], the latest is @msg_seq.
+	 * The lock is for workers adding subscribers.
+	 */
+	pthread_mutex_t subscriber_lock;
+	struct agg_subscriber *subscribers;
+	size_t subscriber_count;
+	struct agg_msg_buf msgs[SUBSCRIBER_BACKLOG];
+	uint64_t msg_seq;
+
+	uint64_t published, intervals, slow_subscribers;
+};
+
+static uint64_t rollup_key(unsigned kind, unsigned domain, unsigned index, uint32_t offset)
+{
+	return (uint64_t)kind << 56 | (uint64_t)(domain & 0xff) << 48 |
+		(uint64_t)(index & 0xffff) << 32 | offset;
+}
+
+/* Keys have the index and domain in their high bits, mix them all in */
+static size_t hash_key(uint64_t key, size_t size)
+{
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	return (key ^ key >> 31) & (size - 1);
+}
+
+static struct rollup *rollup_slot(struct rollup *slots, size_t size, uint64_t key)
+{
+	size_t h = hash_key(key, size);
+	while (slots[h].key && slots[h].key != key)
+		h = (h + 1) & (size - 1);
+	return &slots[h];
+}
+
+static void rollup_add(struct rollup_table *t, uint64_t key, uint64_t value,
+		uint64_t timebase, uint32_t count)
+{
+	if (t->used * 2 >= t->size) {
+		size_t old_size = t->size, i;
+		struct rollup *old = t->slots;
+
+		t->size = old_size ? old_size * 2 : 1024;
+		t->slots = calloc(t->size, sizeof(*t->slots));
+		if (!t->slots)
+			err(1, "alloc failure");
+		for (i = 0; i < old_size; i++)
+			if (old[i].key)
+				*rollup_slot(t->slots, t->size, old[i].key) = old[i];
+		free(old);
+	}
+
+	struct rollup *r = rollup_slot(t->slots, t->size, key);
+	if (!r->key) {
+		r->key = key;
+		t->used++;
+	}
+	r->value += value;
+	r->count += count;
+	if (timebase > r->timebase)
+		r->timebase = timebase;
+}
+
+static void rollup_clear(struct rollup_table *t)
+{
+	if (t->used)
+		memset(t->slots, 0, sizeof(*t->slots) * t->size);
+	t->used = 0;
+}
+
+enum counter_result {
+	/* the sample is newer than the last one, here is the delta */
+	COUNTER_DELTA,
+	/* no newer than the last one, from another lpar or out of order */
+	COUNTER_STALE,
+	/* the counter's first sample, there is nothing to take a delta from */
+	COUNTER_FIRST,
+	/* the table is full */
+	COUNTER_UNTRACKED,
+};
+
+/*
+ * Make @value (read at @timebase) the latest value of the counter, unless
+ * the table already has a value at least as recent. Every lpar reads the
+ * same physical counters, so whichever sample comes first wins and the
+ * others are stale.
+ */
+static enum counter_result counter_update(struct aggregator *a, uint64_t key, unsigned lpar,
+		uint64_t timebase, uint64_t value, uint64_t *delta)
+{
+	size_t h = hash_key(key ^ lpar, a->counter_size), probes;
+	u128 want = (u128)lpar << 64 | key;
+
+	for (probes = 0; probes < a->counter_size; probes++, h = (h + 1) & (a->counter_size - 1)) {
+		struct counter_slot *c = &a->counters[h];
+		u128 k = __atomic_load_n(&c->key, __ATOMIC_ACQUIRE);
+
+		if (!k) {
+			u128 empty = 0;
+			if (!__atomic_compare_exchange_n(&c->key, &empty, want, false,
+						__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) && empty != want)
+				continue;
+		} else if (k != want) {
+			continue;
+		}
+
+		/* replace the latest, losing if someone got there with a later one */
+		u128 latest = __atomic_load_n(&c->latest, __ATOMIC_ACQUIRE);
+		u128 next = (u128)(timebase + 1) << 64 | value;
+		do {
+			if (latest >> 64 && timebase + 1 <= (uint64_t)(latest >> 64))
+				return COUNTER_STALE;
+		} while (!__atomic_compare_exchange_n(&c->latest, &latest, next, true,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+		if (!(latest >> 64))
+			return COUNTER_FIRST;
+		*delta = value - (uint64_t)latest;
+		return COUNTER_DELTA;
+	}
+
+	return COUNTER_UNTRACKED;
+}
+
+/* Move to the shard the publisher asked for, if it asked */
+static void worker_ack(struct agg_worker *w)
+{
+	unsigned active = __atomic_load_n(&w->active, __ATOMIC_ACQUIRE);
+	if (active == w->acked)
+		return;
+
+	/* nothing of the retired shard is touched past this point */
+	pthread_mutex_lock(&w->a->ack_lock);
+	__atomic_store_n(&w->acked, active, __ATOMIC_RELEASE);
+	pthread_cond_signal(&w->a->ack_cond);
+	pthread_mutex_unlock(&w->a->ack_lock);
+}
+
+static void worker_samples(struct agg_worker *w, const struct agg_record *records, size_t n)
+{
+	struct rollup_table *t = &w->shards[w->acked];
+	uint64_t duplicates = 0, first = 0, invalid = 0, untracked = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		struct agg_sample s;
+		unsigned kind, index = 0, lpar = 0;
+		uint64_t delta;
+
+		agg_record_decode(&records[i], &s);
+		if (s.kind != AGG_KIND_SAMPLE) {
+			invalid++;
+			continue;
+		}
+
+		switch (s.domain) {
+		case HV_PERF_DOMAIN_PHYSICAL_CHIP:
+		case HV_PERF_DOMAIN_PHYSICAL_CORE:
+			kind = s.domain == HV_PERF_DOMAIN_PHYSICAL_CHIP ? AGG_KIND_CHIP : AGG_KIND_CORE;
+			index = s.index;
+			break;
+		case HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_HOME_CORE:
+		case HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_HOME_CHIP:
+		case HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_HOME_NODE:
+		case HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_REMOTE_NODE:
+			kind = AGG_KIND_LPAR;
+			index = lpar = s.lpar;
+			break;
+		default:
+			invalid++;
+			continue;
+		}
+
+		switch (counter_update(w->a, rollup_key(0, s.domain, s.index, s.offset), lpar,
+					s.timebase, s.value, &delta)) {
+		case COUNTER_DELTA:
+			rollup_add(t, rollup_key(kind, s.domain, index, s.offset), delta, s.timebase, 1);
+			break;
+		case COUNTER_STALE:
+			duplicates++;
+			break;
+		case COUNTER_FIRST:
+			first++;
+			break;
+		case COUNTER_UNTRACKED:
+			untracked++;
+			break;
+		}
+	}
+
+	__atomic_fetch_add(&w->received, n, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&w->duplicates, duplicates, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&w->first, first, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&w->invalid, invalid, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&w->untracked, untracked, __ATOMIC_RELAXED);
+}
+
+static void add_subscriber(struct aggregator *a, int fd)
+{
+	pthread_mutex_lock(&a->subscriber_lock);
+	a->subscribers = realloc(a->subscribers, sizeof(*a->subscribers) * (a->subscriber_count + 1));
+	if (!a->subscribers)
+		err(1, "alloc failure");
+	/* starting with the next interval, not half way through this one */
+	a->subscribers[a->subscriber_count++] = (struct agg_subscriber) {
+		.fd = fd,
+		.seq = a->msg_seq + 1,
+	};
+	pthread_mutex_unlock(&a->subscriber_lock);
+	pr_debug(1, "subscriber %d", fd);
+}
+
+/* Returns false once the connection is gone (closed or handed off) */
+static bool worker_read(struct agg_worker *w, struct agg_conn *c)
+{
+	const struct agg_record *records;
+	unsigned type;
+	size_t n;
+	int r;
+
+	if (agg_reader_fill(&c->r, c->fd) <= 0)
+		goto drop;
+
+	while ((r = agg_reader_next(&c->r, &type, &records, &n)) == 1) {
+		switch (type) {
+		case AGG_MSG_SAMPLES:
+			/* a long read doesn't hold the publisher up for more than a message */
+			worker_ack(w);
+			worker_samples(w, records, n);
+			break;
+		case AGG_MSG_SUBSCRIBE:
+			add_subscriber(w->a, c->fd);
+			agg_reader_free(&c->r);
+			return false;
+		default:
+			pr_debug(1, "unknown message type %u", type);
+			goto drop;
+		}
+	}
+
+	if (r == 0)
+		return true;
+
+drop:
+	close(c->fd);
+	agg_reader_free(&c->r);
+	return false;
+}
+
+static void worker_adopt(struct agg_worker *w)
+{
+	int fd;
+	while (read(w->wake[0], &fd, sizeof(fd)) == sizeof(fd)) {
+		if (fd < 0)
+			continue;
+
+		w->conns = realloc(w->conns, sizeof(*w->conns) * (w->conn_count + 1));
+		if (!w->conns)
+			err(1, "alloc failure");
+		struct agg_conn *c = &w->conns[w->conn_count++];
+		c->fd = fd;
+		agg_reader_init(&c->r);
+	}
+}
+
+static void *worker_thread(void *arg)
+{
+	struct agg_worker *w = arg;
+	struct pollfd *fds = NULL;
+	size_t fds_alloc = 0, i, j;
+
+	while (!__atomic_load_n(&w->a->stop, __ATOMIC_ACQUIRE)) {
+		if (fds_alloc < w->conn_count + 1) {
+			fds_alloc = (w->conn_count + 1) * 2;
+			fds = realloc(fds, sizeof(*fds) * fds_alloc);
+			if (!fds)
+				err(1, "alloc failure");
+		}
+
+		fds[0] = (struct pollfd) { .fd = w->wake[0], .events = POLLIN };
+		for (i = 0; i < w->conn_count; i++)
+			fds[i + 1] = (struct pollfd) { .fd = w->conns[i].fd, .events = POLLIN };
+
+		if (poll(fds, w->conn_count + 1, -1) < 0 && errno != EINTR)
+			warn("poll");
+
+		worker_ack(w);
+
+		size_t conn_count = w->conn_count;
+		for (i = 0, j = 0; i < conn_count; i++) {
+			if (!fds[i + 1].revents || worker_read(w, &w->conns[i]))
+				w->conns[j++] = w->conns[i];
+		}
+		w->conn_count = j;
+
+		if (fds[0].revents)
+			worker_adopt(w);
+	}
+
+	for (i = 0; i < w->conn_count; i++) {
+		close(w->conns[i].fd);
+		agg_reader_free(&w->conns[i].r);
+	}
+	w->conn_count = 0;
+	free(fds);
+	return NULL;
+}
+
+static void poke(int fd, int v)
+{
+	/* a full pipe already has a wakeup pending */
+	if (write(fd, &v, sizeof(v)) != sizeof(v) && errno != EAGAIN)
+		warn("could not wake worker");
+}
+
+static void merge(struct aggregator *a, struct rollup_table *t)
+{
+	size_t i;
+	for (i = 0; i < t->size; i++) {
+		struct rollup *r = &t->slots[i];
+		if (r->key)
+			rollup_add(&a->merged, r->key, r->value, r->timebase, r->count);
+	}
+	rollup_clear(t);
+}
+
+static void drop_subscriber(struct aggregator *a, size_t i)
+{
+	pr_debug(1, "dropping subscriber %d", a->subscribers[i].fd);
+	close(a->subscribers[i].fd);
+	a->subscribers[i] = a->subscribers[--a->subscriber_count];
+}
+
+/*
+ * Send each subscriber as much of its backlog as it takes without blocking,
+ * dropping those that are gone. Called with subscriber_lock held.
+ */
+static void subscribers_flush(struct aggregator *a)
+{
+	size_t i;
+
+	for (i = 0; i < a->subscriber_count; ) {
+		struct agg_subscriber *sub = &a->subscribers[i];
+		bool gone = false;
+
+		while (sub->seq <= a->msg_seq) {
+			struct agg_msg_buf *m = &a->msgs[sub->seq % SUBSCRIBER_BACKLOG];
+			if (sub->sent == m->len) {
+				sub->seq++;
+				sub->sent = 0;
+				continue;
+			}
+
+			ssize_t r = send(sub->fd, m->buf + sub->sent, m->len - sub->sent,
+					MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (r < 0) {
+				if (errno == EINTR)
+					continue;
+				gone = errno != EAGAIN && errno != EWOULDBLOCK;
+				break;
+			}
+			sub->sent += r;
+		}
+
+		if (gone)
+			drop_subscriber(a, i);
+		else
+			i++;
+	}
+}
+
+/*
+ * Append a POLLOUT entry for each subscriber with a backlog to @a->fds,
+ * after the first @n. Returns the new number of entries.
+ */
+static size_t subscriber_pollfds(struct aggregator *a, size_t n)
+{
+	size_t i;
+
+	pthread_mutex_lock(&a->subscriber_lock);
+	if (a->fds_alloc < n + a->subscriber_count) {
+		a->fds_alloc = (n + a->subscriber_count) * 2;
+		a->fds = realloc(a->fds, sizeof(*a->fds) * a->fds_alloc);
+		if (!a->fds)
+			err(1, "alloc failure");
+	}
+	for (i = 0; i < a->subscriber_count; i++)
+		if (a->subscribers[i].seq <= a->msg_seq)
+			a->fds[n++] = (struct pollfd) { .fd = a->subscribers[i].fd, .events = POLLOUT };
+	pthread_mutex_unlock(&a->subscriber_lock);
+
+	return n;
+}
+
+/*
+ * With @flip, switch every worker over to its other shard and merge the one
+ * it was using. Without, the workers must have stopped.
+ */
+static void publish(struct aggregator *a, bool flip)
+{
+	size_t i, n = 0;
+
+	if (flip) {
+		/* flip them all, then wait for them all */
+		for (i = 0; i < a->worker_count; i++) {
+			struct agg_worker *w = &a->workers[i];
+			__atomic_store_n(&w->active, !w->active, __ATOMIC_RELEASE);
+			poke(w->wake[1], -1);
+		}
+
+		pthread_mutex_lock(&a->ack_lock);
+		for (i = 0; i < a->worker_count; i++)
+			while (__atomic_load_n(&a->workers[i].acked, __ATOMIC_ACQUIRE) !=
+					a->workers[i].active)
+				pthread_cond_wait(&a->ack_cond, &a->ack_lock);
+		pthread_mutex_unlock(&a->ack_lock);
+
+		for (i = 0; i < a->worker_count; i++)
+			merge(a, &a->workers[i].shards[!a->workers[i].active]);
+	} else {
+		for (i = 0; i < a->worker_count; i++) {
+			merge(a, &a->workers[i].shards[0]);
+			merge(a, &a->workers[i].shards[1]);
+		}
+	}
+
+	if (a->out_alloc < a->merged.used) {
+		a->out_alloc = a->merged.used;
+		a->out = realloc(a->out, sizeof(*a->out) * a->out_alloc);
+		if (!a->out)
+			err(1, "alloc failure");
+	}
+
+	for (i = 0; i < a->merged.size; i++) {
+		struct rollup *r = &a->merged.slots[i];
+		if (!r->key)
+			continue;
+		unsigned kind = r->key >> 56;
+		a->out[n++] = (struct agg_sample) {
+			.kind = kind,
+			.domain = r->key >> 48 & 0xff,
+			.index = r->key >> 32 & 0xffff,
+			.lpar = kind == AGG_KIND_LPAR ? r->key >> 32 & 0xffff : 0,
+			.offset = r->key & 0xffffffff,
+			.count = r->count,
+			.timebase = r->timebase,
+			.value = r->value,
+		};
+	}
+	rollup_clear(&a->merged);
+
+	/*
+	 * Encoded once for every subscriber, over the oldest message: only
+	 * this thread sends, so nothing is reading it.
+	 */
+	uint64_t seq = a->msg_seq + 1;
+	if (n) {
+		struct agg_msg_buf *m = &a->msgs[seq % SUBSCRIBER_BACKLOG];
+		m->len = agg_encode(AGG_MSG_SAMPLES, a->out, n, &m->buf, &m->alloc);
+	}
+
+	pthread_mutex_lock(&a->subscriber_lock);
+	if (n) {
+		/* those still on the message just replaced are too far behind */
+		for (i = 0; i < a->subscriber_count; ) {
+			if (a->subscribers[i].seq + SUBSCRIBER_BACKLOG <= seq) {
+				__atomic_fetch_add(&a->slow_subscribers, 1, __ATOMIC_RELAXED);
+				drop_subscriber(a, i);
+				continue;
+			}
+			i++;
+		}
+		a->msg_seq = seq;
+	}
+	subscribers_flush(a);
+	pthread_mutex_unlock(&a->subscriber_lock);
+
+	__atomic_fetch_add(&a->published, n, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&a->intervals, 1, __ATOMIC_RELAXED);
+	pr_debug(2, "published %zu rollups", n);
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *control_thread(void *arg)
+{
+	struct aggregator *a = arg;
+	uint64_t next = now_ms() + a->interval_ms;
+	unsigned rr = 0;
+
+	for (;;) {
+		size_t nfds = subscriber_pollfds(a, 2), i;
+		struct pollfd *fds = a->fds;
+		fds[0] = (struct pollfd) { .fd = a->stop_pipe[0], .events = POLLIN };
+		fds[1] = (struct pollfd) { .fd = a->listen_fd, .events = POLLIN };
+		uint64_t now = now_ms();
+		int timeout = next > now ? (int)(next - now) : 0;
+
+		if (poll(fds, nfds, timeout) < 0 && errno != EINTR)
+			warn("poll");
+
+		if (fds[0].revents)
+			break;
+
+		for (i = 2; i < nfds && !fds[i].revents; i++)
+			;
+		if (i < nfds) {
+			pthread_mutex_lock(&a->subscriber_lock);
+			subscribers_flush(a);
+			pthread_mutex_unlock(&a->subscriber_lock);
+		}
+
+		if (fds[1].revents) {
+			int fd = accept(a->listen_fd, NULL, NULL);
+			if (fd == -1)
+				warn("accept");
+			else if (write(a->workers[rr++ % a->worker_count].wake[1], &fd, sizeof(fd)) != sizeof(fd)) {
+				warn("could not hand off connection");
+				close(fd);
+			}
+		}
+
+		now = now_ms();
+		if (now >= next) {
+			publish(a, true);
+			next += a->interval_ms;
+			if (next <= now)
+				next = now + a->interval_ms;
+		}
+	}
+
+	return NULL;
+}
+
+struct aggregator *aggregator_start(const char *path, unsigned workers,
+		unsigned interval_ms, size_t counter_slots)
+{
+	struct aggregator *a = calloc(1, sizeof(*a));
+	unsigned i;
+	int r;
+
+	if (!a)
+		err(1, "alloc failure");
+	if (!workers)
+		workers = 1;
+
+	a->listen_fd = agg_listen(path);
+	if (a->listen_fd == -1) {
+		free(a);
+		return NULL;
+	}
+
+	a->path = strdup(path);
+	if (!a->path)
+		err(1, "alloc failure");
+	a->interval_ms = interval_ms;
+	pthread_mutex_init(&a->subscriber_lock, NULL);
+	pthread_mutex_init(&a->ack_lock, NULL);
+	pthread_cond_init(&a->ack_cond, NULL);
+
+	for (a->counter_size = 1; a->counter_size < counter_slots; a->counter_size *= 2)
+		;
+	if (posix_memalign((void **)&a->counters, 64, sizeof(*a->counters) * a->counter_size))
+		err(1, "alloc failure");
+	memset(a->counters, 0, sizeof(*a->counters) * a->counter_size);
+
+	if (posix_memalign((void **)&a->workers, 64, sizeof(*a->workers) * workers))
+		err(1, "alloc failure");
+	memset(a->workers, 0, sizeof(*a->workers) * workers);
+	a->worker_count = workers;
+
+	for (i = 0; i < workers; i++) {
+		struct agg_worker *w = &a->workers[i];
+		w->a = a;
+		if (pipe(w->wake) || fcntl(w->wake[0], F_SETFL, O_NONBLOCK) ||
+				fcntl(w->wake[1], F_SETFL, O_NONBLOCK))
+			err(1, "could not create pipe");
+		r = pthread_create(&w->thread, NULL, worker_thread, w);
+		if (r) {
+			errno = r;
+			err(1, "could not create worker thread");
+		}
+	}
+
+	if (pipe(a->stop_pipe))
+		err(1, "could not create pipe");
+
+	r = pthread_create(&a->thread, NULL, control_thread, a);
+	if (r) {
+		errno = r;
+		err(1, "could not create aggregator thread");
+	}
+
+	return a;
+}
+
+void aggregator_stop(struct aggregator *a, struct aggregator_stats *st)
+{
+	unsigned i;
+	size_t j;
+
+	if (write(a->stop_pipe[1], "", 1) != 1)
+		warn("could not stop aggregator thread");
+	pthread_join(a->thread, NULL);
+
+	__atomic_store_n(&a->stop, true, __ATOMIC_RELEASE);
+	for (i = 0; i < a->worker_count; i++) {
+		poke(a->workers[i].wake[1], -1);
+		pthread_join(a->workers[i].thread, NULL);
+	}
+
+	publish(a, false);
+
+	/* give subscribers an interval to take the last rollups */
+	uint64_t deadline = now_ms() + a->interval_ms;
+	for (;;) {
+		size_t nfds = subscriber_pollfds(a, 0);
+		uint64_t now = now_ms();
+		if (!nfds || now >= deadline)
+			break;
+		if (poll(a->fds, nfds, deadline - now) < 0 && errno != EINTR)
+			warn("poll");
+		pthread_mutex_lock(&a->subscriber_lock);
+		subscribers_flush(a);
+		pthread_mutex_unlock(&a->subscriber_lock);
+	}
+
+	if (st)
+		aggregator_stats(a, st);
+
+	for (i = 0; i < a->worker_count; i++) {
+		struct agg_worker *w = &a->workers[i];
+		int fd;
+		/* connections handed off but never adopted */
+		while (read(w->wake[0], &fd, sizeof(fd)) == sizeof(fd))
+			if (fd >= 0)
+				close(fd);
+		close(w->wake[0]);
+		close(w->wake[1]);
+		free(w->conns);
+		free(w->shards[0].slots);
+		free(w->shards[1].slots);
+	}
+
+	for (j = 0; j < a->subscriber_count; j++)
+		close(a->subscribers[j].fd);
+
+	close(a->stop_pipe[0]);
+	close(a->stop_pipe[1]);
+	close(a->listen_fd);
+	unlink(a->path);
+
+	pthread_mutex_destroy(&a->subscriber_lock);
+	pthread_mutex_destroy(&a->ack_lock);
+	pthread_cond_destroy(&a->ack_cond);
+	free(a->subscribers);
+	free(a->merged.slots);
+	free(a->out);
+	for (j = 0; j < SUBSCRIBER_BACKLOG; j++)
+		free(a->msgs[j].buf);
+	free(a->fds);
+	free(a->counters);
+	free(a->workers);
+	free(a->path);
+	free(a);
+}
+
+void aggregator_stats(struct aggregator *a, struct aggregator_stats *st)
+{
+	unsigned i;
+
+	memset(st, 0, sizeof(*st));
+	for (i = 0; i < a->worker_count; i++) {
+		struct agg_worker *w = &a->workers[i];
+		st->received += __atomic_load_n(&w->received, __ATOMIC_RELAXED);
+		st->duplicates += __atomic_load_n(&w->duplicates, __ATOMIC_RELAXED);
+		st->first += __atomic_load_n(&w->first, __ATOMIC_RELAXED);
+		st->invalid += __atomic_load_n(&w->invalid, __ATOMIC_RELAXED);
+		st->untracked += __atomic_load_n(&w->untracked, __ATOMIC_RELAXED);
+	}
+	st->published = __atomic_load_n(&a->published, __ATOMIC_RELAXED);
+	st->intervals = __atomic_load_n(&a->intervals, __ATOMIC_RELAXED);
+	st->slow_subscribers = __atomic_load_n(&a->slow_subscribers, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef AGGREGATOR_H_
+#define AGGREGATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "agg-proto.h"
+
+/*
+ * Collects samples from many collectors (see agg-proto.h) and publishes
+ * per-chip, per-core and per-lpar rollups to subscribers every interval.
+ *
+ * Samples carry raw counter values. The aggregator keeps the latest value
+ * (and its timebase) of every counter: (domain, index, offset), and the lpar
+ * for the virtual domains. A sample later than the latest becomes a delta
+ * against it; one no later is dropped. Each lpar collecting a physical domain
+ * sees the same counters, so however many collectors read one, at whatever
+ * interval, its deltas add up to how much it counted.
+ *
+ * Connections are spread over worker threads. The latest values are in one
+ * table shared by every worker, updated with compare and swaps. Each worker
+ * rolls the deltas up into its own shard, which no other thread touches
+ * until, at the end of an interval, the publisher switches every worker to
+ * its other shard and merges the ones just retired.
+ *
+ * Subscribers are never waited on: the rollups of the last 4 intervals are
+ * kept and sent as fast as each subscriber takes them. One that falls
+ * further behind than that is dropped.
+ */
+
+struct aggregator;
+
+struct aggregator_stats {
+	uint64_t received;
+	/* samples no later than their counter's latest */
+	uint64_t duplicates;
+	/* samples that only gave their counter a starting value */
+	uint64_t first;
+	/* samples of an unknown kind or domain */
+	uint64_t invalid;
+	/* samples of counters the table had no room for */
+	uint64_t untracked;
+	uint64_t published;
+	uint64_t intervals;
+	/* dropped for not keeping up */
+	uint64_t slow_subscribers;
+};
+
+/* @counter_slots is rounded up to a power of 2 */
+struct aggregator *aggregator_start(const char *path, unsigned workers,
+		unsigned interval_ms, size_t counter_slots);
+/*
+ * Publishes whatever was collected during the last (partial) interval.
+ * Final stats are stored in @st, if not NULL.
+ */
+void aggregator_stop(struct aggregator *a, struct aggregator_stats *st);
+
+void aggregator_stats(struct aggregator *a, struct aggregator_stats *st);
+
+#endif
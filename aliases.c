@@ -0,0 +1,110 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/*
+ * Check that the kernel's hv_24x7 event aliases match what the catalog
+ * says they should be.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+
+#include "catalog.h"
+#include "pmu-aliases.h"
+
+static void _usage(const char *p, int e)
+{
+	FILE *o = stderr;
+	fprintf(o,
+"usage: %s [-q] <pmu sysfs dir> [<catalog file>]\n"
+"\n"
+"Compare the aliases in <pmu sysfs dir>/events/ with the events of the\n"
+"catalog (by default, <pmu sysfs dir>/interface/catalog), printing each\n"
+"missing, extra or mismatched alias.\n"
+"\n"
+"  -q   only print the totals\n", p);
+	exit(e);
+}
+
+#define _PRGM_NAME "alias-check"
+#define PRGM_NAME  (argc?argv[0]:_PRGM_NAME)
+#define usage(argc, argv, e) _usage(PRGM_NAME, e)
+#define U(e) usage(argc, argv, e)
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	char events[PATH_MAX], catalog[PATH_MAX];
+	bool quiet = false;
+	int opt;
+
+	err_set_progname(PRGM_NAME);
+
+	while ((opt = getopt(argc, argv, "qh")) != -1) {
+		switch (opt) {
+		case 'q':
+			quiet = true;
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (argc - optind < 1 || argc - optind > 2)
+		U(1);
+
+	const char *pmu_dir = argv[optind];
+	snprintf(events, sizeof(events), "%s/events", pmu_dir);
+	if (argc - optind == 2)
+		snprintf(catalog, sizeof(catalog), "%s", argv[optind + 1]);
+	else
+		snprintf(catalog, sizeof(catalog), "%s/interface/catalog", pmu_dir);
+
+	struct catalog c;
+	uint64_t t0 = now_ns();
+	if (catalog_load(&c, catalog))
+		return 1;
+
+	uint64_t t1 = now_ns();
+	struct pmu_aliases a;
+	if (pmu_aliases_read(&a, events))
+		return 1;
+
+	uint64_t t2 = now_ns();
+	struct pmu_aliases_check st;
+	size_t problems = pmu_aliases_check(&a, &c, quiet ? NULL : stdout, &st);
+	uint64_t t3 = now_ns();
+
+	printf("%zu events in the catalog (%.3f ms), %zu aliases (%zu bad) in %s (%.3f ms)\n",
+			c.event_count, (t1 - t0) / 1e6, a.count, a.bad, events, (t2 - t1) / 1e6);
+	printf("%zu expected: %zu missing, %zu extra, %zu mismatched (%.3f ms)\n",
+			st.expected, st.missing, st.extra, st.mismatched, (t3 - t2) / 1e6);
+
+	bool bad = a.bad;
+	pmu_aliases_free(&a);
+	catalog_free(&c);
+	return problems || bad;
+}
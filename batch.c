@@ -0,0 +1,447 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/*
+ * Decode many catalogs at once. Catalogs collected from a fleet are mostly
+ * copies of a few firmware builds, so each input is fingerprinted (page 0
+ * version & build_time_stamp plus a content hash) and only one catalog per
+ * fingerprint is decoded. The output for each unique catalog is written to
+ * '<outdir>/<fingerprint>.txt' and a '<file>\t<fingerprint>' line is emitted
+ * for every input.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+#include <ccan/endian/endian.h>
+
+#include <penny/penny.h>
+#include <penny/math.h>
+
+#include "catalog.h"
+
+struct input {
+	char *path;
+
+	void *data;
+	size_t len;
+	size_t map_len;
+	bool mapped;
+	bool ok;
+
+	/* fingerprint */
+	uint64_t version;
+	char stamp[sizeof(((struct hv_24x7_catalog_page_0 *)0)->build_time_stamp) + 1];
+	uint64_t hash;
+
+	struct unique *unique;
+};
+
+struct unique {
+	struct input *rep;
+	/* "<version>-<build_time_stamp>-<hash>[-<collision #>]" */
+	char id[80];
+	bool ok;
+};
+
+struct batch {
+	const char *outdir;
+
+	struct input *inputs;
+	size_t input_count;
+
+	struct unique *uniques;
+	size_t unique_count;
+};
+
+/*
+ * Not cryptographic, just quick: 8 bytes per multiply. Any bytes past the
+ * last full word are folded in individually.
+ */
+static uint64_t content_hash(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+	size_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		uint64_t w;
+		memcpy(&w, p + i, sizeof(w));
+		h ^= w;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+
+	for (; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/*
+ * Simple worker pool: @fn is called once for each index in [0, n), spread
+ * across @jobs threads (including the calling one).
+ */
+struct pool_work {
+	size_t next;
+	size_t n;
+	void (*fn)(struct batch *b, size_t i);
+	struct batch *b;
+};
+
+static void *pool_worker(void *arg)
+{
+	struct pool_work *w = arg;
+	size_t i;
+	while ((i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED)) < w->n)
+		w->fn(w->b, i);
+	return NULL;
+}
+
+static void pool_run(unsigned jobs, size_t n, void (*fn)(struct batch *b, size_t i), struct batch *b)
+{
+	struct pool_work w = { .next = 0, .n = n, .fn = fn, .b = b };
+	unsigned threads = min((size_t)jobs, n);
+	pthread_t *tids = NULL;
+	unsigned i;
+
+	if (threads > 1) {
+		tids = malloc(sizeof(*tids) * (threads - 1));
+		if (!tids)
+			err(1, "alloc failure");
+	}
+
+	for (i = 0; i + 1 < threads; i++) {
+		int r = pthread_create(&tids[i], NULL, pool_worker, &w);
+		if (r) {
+			errno = r;
+			err(1, "could not create worker thread");
+		}
+	}
+
+	pool_worker(&w);
+
+	for (i = 0; i + 1 < threads; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+}
+
+static void input_fingerprint(struct batch *b, size_t ix)
+{
+	struct input *in = &b->inputs[ix];
+	struct stat st;
+	int fd = open(in->path, O_RDONLY);
+	if (fd == -1) {
+		warn("could not open %s", in->path);
+		return;
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= CATALOG_PAGE_SIZE) {
+		void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (m != MAP_FAILED) {
+			in->data = m;
+			in->len = in->map_len = st.st_size;
+			in->mapped = true;
+		}
+	}
+	close(fd);
+
+	/* sysfs files don't report a size */
+	if (!in->mapped && catalog_read(in->path, &in->data, &in->len))
+		return;
+
+	if (in->len < CATALOG_PAGE_SIZE) {
+		warnx("%s: could not read page 0, got %zu bytes", in->path, in->len);
+		return;
+	}
+
+	struct hv_24x7_catalog_page_0 *p0 = in->data;
+	if (be_to_cpu(p0->magic) != HV_24X7_CATALOG_MAGIC) {
+		warnx("%s: not a catalog (magic=0x%08x)", in->path, (unsigned)be_to_cpu(p0->magic));
+		return;
+	}
+
+	/* ignore anything following the catalog */
+	size_t catalog_bytes = (size_t)be_to_cpu(p0->length) * CATALOG_PAGE_SIZE;
+	if (catalog_bytes && catalog_bytes < in->len)
+		in->len = catalog_bytes;
+
+	size_t i;
+	in->version = be_to_cpu(p0->version);
+	for (i = 0; i < sizeof(p0->build_time_stamp) && p0->build_time_stamp[i]; i++)
+		in->stamp[i] = isalnum((unsigned char)p0->build_time_stamp[i]) ? p0->build_time_stamp[i] : '_';
+	in->stamp[i] = '\0';
+	in->hash = content_hash(in->data, in->len);
+	in->ok = true;
+
+	pr_debug(2, "%s: version=%"PRIu64" stamp=%s hash=%016"PRIx64,
+			in->path, in->version, in->stamp, in->hash);
+}
+
+static int fingerprint_cmp(const void *a_, const void *b_)
+{
+	const struct input *a = *(const struct input **)a_, *b = *(const struct input **)b_;
+	int r;
+
+	if (a->version != b->version)
+		return a->version < b->version ? -1 : 1;
+	r = strcmp(a->stamp, b->stamp);
+	if (r)
+		return r;
+	if (a->hash != b->hash)
+		return a->hash < b->hash ? -1 : 1;
+	if (a->len != b->len)
+		return a->len < b->len ? -1 : 1;
+	return 0;
+}
+
+static void dedupe(struct batch *b)
+{
+	struct input **sorted = malloc(sizeof(*sorted) * b->input_count);
+	size_t i, n = 0;
+	if (!sorted)
+		err(1, "alloc failure");
+
+	b->uniques = calloc(b->input_count, sizeof(*b->uniques));
+	if (!b->uniques && b->input_count)
+		err(1, "alloc failure");
+
+	for (i = 0; i < b->input_count; i++)
+		if (b->inputs[i].ok)
+			sorted[n++] = &b->inputs[i];
+
+	qsort(sorted, n, sizeof(*sorted), fingerprint_cmp);
+
+	size_t run_start = 0;
+	for (i = 0; i < n; i++) {
+		struct input *in = sorted[i];
+		size_t u;
+
+		if (i && fingerprint_cmp(&sorted[i - 1], &sorted[i]))
+			run_start = b->unique_count;
+
+		/*
+		 * Equal fingerprints are confirmed byte for byte. A mismatch
+		 * here is a hash collision, give it its own result.
+		 */
+		for (u = run_start; u < b->unique_count; u++) {
+			struct input *rep = b->uniques[u].rep;
+			if (!memcmp(rep->data, in->data, in->len))
+				break;
+		}
+
+		if (u == b->unique_count) {
+			struct unique *nu = &b->uniques[b->unique_count++];
+			nu->rep = in;
+			int l = snprintf(nu->id, sizeof(nu->id), "%"PRIu64"-%s-%016"PRIx64,
+					in->version, in->stamp, in->hash);
+			if (u != run_start)
+				snprintf(nu->id + l, sizeof(nu->id) - l, "-%zu", u - run_start);
+		}
+
+		in->unique = &b->uniques[u];
+	}
+
+	free(sorted);
+}
+
+static void unique_decode(struct batch *b, size_t ix)
+{
+	struct unique *u = &b->uniques[ix];
+	struct catalog c;
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s.txt", b->outdir, u->id);
+	pr_debug(1, "decoding %s to %s", u->rep->path, path);
+
+	if (catalog_decode(&c, u->rep->data, u->rep->len)) {
+		warnx("%s: could not decode catalog", u->rep->path);
+		return;
+	}
+
+	FILE *o = fopen(path, "w");
+	if (!o) {
+		warn("could not open %s", path);
+		goto out;
+	}
+
+	catalog_print(&c, o);
+	if (fclose(o))
+		warn("could not write %s", path);
+	else
+		u->ok = true;
+
+out:
+	catalog_free(&c);
+}
+
+static void add_input(struct batch *b, size_t *alloc, char *path)
+{
+	if (b->input_count == *alloc) {
+		*alloc = *alloc ? *alloc * 2 : 64;
+		b->inputs = realloc(b->inputs, sizeof(*b->inputs) * *alloc);
+		if (!b->inputs)
+			err(1, "alloc failure");
+	}
+
+	memset(&b->inputs[b->input_count], 0, sizeof(b->inputs[0]));
+	b->inputs[b->input_count++].path = path;
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Directories are expanded (non-recursively) in name order */
+static void add_path(struct batch *b, size_t *alloc, const char *path)
+{
+	struct stat st;
+	if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+		DIR *d = opendir(path);
+		struct dirent *de;
+		char **names = NULL;
+		size_t n = 0, names_alloc = 0, i;
+
+		if (!d) {
+			warn("could not open directory %s", path);
+			return;
+		}
+
+		while ((de = readdir(d))) {
+			if (de->d_name[0] == '.')
+				continue;
+
+			size_t l = strlen(path) + 1 + strlen(de->d_name) + 1;
+			char *p = malloc(l);
+			if (!p)
+				err(1, "alloc failure");
+			snprintf(p, l, "%s/%s", path, de->d_name);
+
+			if (stat(p, &st) || !S_ISREG(st.st_mode)) {
+				free(p);
+				continue;
+			}
+
+			if (n == names_alloc) {
+				names_alloc = names_alloc ? names_alloc * 2 : 64;
+				names = realloc(names, sizeof(*names) * names_alloc);
+				if (!names)
+					err(1, "alloc failure");
+			}
+			names[n++] = p;
+		}
+		closedir(d);
+
+		qsort(names, n, sizeof(*names), name_cmp);
+		for (i = 0; i < n; i++)
+			add_input(b, alloc, names[i]);
+		free(names);
+		return;
+	}
+
+	char *p = strdup(path);
+	if (!p)
+		err(1, "alloc failure");
+	add_input(b, alloc, p);
+}
+
+static void _usage(const char *p, int e)
+{
+	FILE *o = stderr;
+	fprintf(o, "usage: %s [-j jobs] [-o outdir] <catalog file|dir>...\n", p);
+	exit(e);
+}
+
+#define _PRGM_NAME "catalog-batch"
+#define PRGM_NAME  (argc?argv[0]:_PRGM_NAME)
+#define usage(argc, argv, e) _usage(PRGM_NAME, e)
+#define U(e) usage(argc, argv, e)
+
+int main(int argc, char **argv)
+{
+	struct batch b = { .outdir = "." };
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t alloc = 0, i;
+	int opt, ret = 0;
+
+	err_set_progname(PRGM_NAME);
+
+	while ((opt = getopt(argc, argv, "j:o:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			jobs = strtol(optarg, NULL, 0);
+			if (jobs < 1)
+				errx(1, "invalid job count: %s", optarg);
+			break;
+		case 'o':
+			b.outdir = optarg;
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (optind >= argc)
+		U(1);
+	if (jobs < 1)
+		jobs = 1;
+
+	for (i = optind; i < (size_t)argc; i++)
+		add_path(&b, &alloc, argv[i]);
+
+	pool_run(jobs, b.input_count, input_fingerprint, &b);
+	dedupe(&b);
+	pr_debug(1, "%zu inputs, %zu unique catalogs", b.input_count, b.unique_count);
+	pool_run(jobs, b.unique_count, unique_decode, &b);
+
+	for (i = 0; i < b.input_count; i++) {
+		struct input *in = &b.inputs[i];
+		if (in->unique && in->unique->ok) {
+			printf("%s\t%s\n", in->path, in->unique->id);
+		} else {
+			printf("%s\t-\n", in->path);
+			ret = 1;
+		}
+	}
+
+	for (i = 0; i < b.input_count; i++) {
+		struct input *in = &b.inputs[i];
+		if (in->mapped)
+			munmap(in->data, in->map_len);
+		else
+			free(in->data);
+		free(in->path);
+	}
+	free(b.inputs);
+	free(b.uniques);
+
+	return ret;
+}
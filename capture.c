@@ -0,0 +1,503 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/*
+ * Replay captured H_GET_24X7_DATA calls through the decoder, as fast as
+ * possible or paced like the original collection, and synthesize captures
+ * from a catalog so the decode path can be run (and benchmarked) anywhere.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+#include <ccan/endian/endian.h>
+
+#include <penny/penny.h>
+
+#include "catalog.h"
+#include "hv-capture.h"
+#include "hv-decode.h"
+
+static void _usage(const char *p, int e)
+{
+	FILE *o = stderr;
+	fprintf(o,
+"usage: %s replay [-s speed] [-l loops] [-t timebase_hz] [-p] <catalog> <capture>\n"
+"       %s synth [-d domain] [-g groups] [-i indexes] [-n intervals] [-P period_us]\n"
+"                [-r result_bytes] <catalog> <capture>\n"
+"       %s info <capture>\n"
+"\n"
+"replay decodes every record, by default as fast as possible (-s 0). With\n"
+"-s N, records are replayed at N times the speed they were captured at.\n"
+"synth writes a capture of group record requests with steadily counting\n"
+"counters, as the hypervisor would return them. Each interval takes as many\n"
+"calls as it needs for their results to fit in -r bytes (default: 4096).\n", p, p, p);
+	exit(e);
+}
+
+#define _PRGM_NAME "hv-capture"
+#define PRGM_NAME  (argc?argv[0]:_PRGM_NAME)
+#define usage(argc, argv, e) _usage(PRGM_NAME, e)
+#define U(e) usage(argc, argv, e)
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t t)
+{
+	struct timespec ts = {
+		.tv_sec = t / 1000000000,
+		.tv_nsec = t % 1000000000,
+	};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+struct replay_stats {
+	bool print;
+	uint64_t samples;
+	/* order dependent, so a regression in decode changes it */
+	uint64_t checksum;
+};
+
+static int replay_sample(void *arg, const struct hv_sample *s)
+{
+	struct replay_stats *st = arg;
+
+	st->samples++;
+	st->checksum = (st->checksum ^ (s->event->ix << 32 | s->domain_ix) ^ s->delta) *
+		0x100000001b3ULL;
+
+	if (st->print) {
+		size_t nl;
+		const char *name = event_name(s->event->data, &nl);
+		printf("%"PRIu64" %.*s domain=0x%x,ix=%u,lpar=%u value=%"PRIu64" delta=%"PRIu64" rate=%.0f\n",
+				s->timestamp_ns, (int)nl, name, s->domain, s->domain_ix,
+				s->lpar_ix, s->value, s->delta, s->rate);
+	}
+
+	return 0;
+}
+
+static int cmd_replay(int argc, char **argv)
+{
+	struct replay_stats st = { .checksum = 0xcbf29ce484222325ULL };
+	uint64_t timebase_hz = HV_TIMEBASE_HZ_DEFAULT;
+	unsigned long loops = 1, loop;
+	double speed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:l:t:ph")) != -1) {
+		switch (opt) {
+		case 's':
+			speed = strtod(optarg, NULL);
+			break;
+		case 'l':
+			loops = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			timebase_hz = strtoull(optarg, NULL, 0);
+			break;
+		case 'p':
+			st.print = true;
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (argc - optind != 2 || speed < 0 || !timebase_hz)
+		U(1);
+
+	struct catalog c;
+	if (catalog_load(&c, argv[optind]))
+		return 1;
+
+	struct hv_capture_reader *r = hv_capture_open(argv[optind + 1]);
+	if (!r)
+		return 1;
+
+	if (hv_capture_catalog_version(r) != be_to_cpu(c.page_0->version))
+		warnx("capture was made with catalog version %"PRIu64", not %"PRIu64,
+				hv_capture_catalog_version(r), (uint64_t)be_to_cpu(c.page_0->version));
+
+	struct hv_decoder *d = hv_decoder_new(&c, timebase_hz);
+	uint64_t records = 0, errors = 0, bytes = 0;
+	uint64_t start = now_ns();
+	int ret = 0;
+
+	for (loop = 0; loop < loops && !ret; loop++) {
+		uint64_t loop_start = now_ns(), first_ts = 0;
+		const void *req, *res;
+		size_t req_len, res_len;
+		uint64_t ts;
+		bool first = true;
+
+		/* counters appear to go backwards when starting over */
+		hv_decoder_reset(d);
+		hv_capture_rewind(r);
+
+		while ((ret = hv_capture_next(r, &ts, &req, &req_len, &res, &res_len)) == 1) {
+			if (first) {
+				first_ts = ts;
+				first = false;
+			}
+
+			if (speed && ts > first_ts)
+				sleep_until_ns(loop_start + (uint64_t)((ts - first_ts) / speed));
+
+			if (hv_decode(d, ts, req, req_len, res, res_len, replay_sample, &st))
+				errors++;
+			records++;
+			bytes += req_len + res_len;
+		}
+	}
+
+	double secs = (now_ns() - start) / 1e9;
+	fprintf(stderr,
+		"%"PRIu64" records, %"PRIu64" samples, %"PRIu64" errors in %.3f s\n"
+		"%.0f records/s, %.0f samples/s, %.1f MB/s\n"
+		"checksum %016"PRIx64"\n",
+		records, st.samples, errors, secs,
+		records / secs, st.samples / secs, bytes / secs / 1e6,
+		st.checksum);
+
+	hv_decoder_free(d);
+	hv_capture_reader_close(r);
+	catalog_free(&c);
+	return ret < 0 || errors;
+}
+
+static uint64_t xorshift64(uint64_t *s)
+{
+	uint64_t x = *s;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *s = x;
+}
+
+/* One H_GET_24X7_DATA call of a synthesized capture */
+struct synth_call {
+	unsigned char *req, *res;
+	size_t req_len, res_len;
+	/* the group each request reads */
+	struct hv_24x7_group_data **groups;
+};
+
+/*
+ * Advance every counter (and the timebase) of every group record in the
+ * call's result buffer, in place.
+ */
+static void synth_update(struct catalog *c, struct synth_call *call,
+		uint64_t timebase, uint64_t *rand)
+{
+	struct hv_24x7_data_result_buffer *rb = (void *)call->res;
+	unsigned char *p = (unsigned char *)rb->results;
+	size_t i, j, k;
+
+	for (i = 0; i < rb->num_results; i++) {
+		struct hv_24x7_result *r = (void *)p;
+		unsigned data_size = be_to_cpu(r->result_element_data_size);
+		size_t elements = be_to_cpu(r->num_elements_returned);
+		struct hv_24x7_grs *s = c->schemas[call->groups[r->result_ix]->group_schema_ix];
+		struct hv_24x7_grs_field *f = (void *)s->field_entrys;
+
+		p += sizeof(*r);
+		for (j = 0; j < elements; j++) {
+			struct hv_24x7_result_element *e = (void *)p;
+			for (k = 0; k < be_to_cpu(s->field_entry_count); k++) {
+				unsigned fe = be_to_cpu(f[k].field_enum);
+				unsigned offs = be_to_cpu(f[k].offs);
+				uint64_t v;
+
+				if (be_to_cpu(f[k].length) != 8 || offs + 8 > data_size)
+					continue;
+
+				if (fe == GRS_TIMEBASE_UPDATE) {
+					v = timebase;
+				} else if (fe >= GRS_COUNTER_BASE && fe <= GRS_COUNTER_LAST) {
+					memcpy(&v, e->element_data + offs, sizeof(v));
+					v = be64_to_cpu(v) + (xorshift64(rand) & 0xfffff);
+				} else {
+					continue;
+				}
+
+				v = cpu_to_be64(v);
+				memcpy(e->element_data + offs, &v, sizeof(v));
+			}
+			p += sizeof(*e) + data_size;
+		}
+	}
+}
+
+static struct synth_call *synth_call_new(struct synth_call **calls, size_t *call_count,
+		struct catalog *c)
+{
+	*calls = realloc(*calls, sizeof(**calls) * (*call_count + 1));
+	if (!*calls)
+		err(1, "alloc failure");
+
+	struct synth_call *call = &(*calls)[(*call_count)++];
+	call->req_len = sizeof(struct hv_24x7_request_buffer);
+	call->res_len = sizeof(struct hv_24x7_data_result_buffer);
+	call->req = calloc(1, call->req_len);
+	call->res = calloc(1, call->res_len);
+	call->groups = NULL;
+	if (!call->req || !call->res)
+		err(1, "alloc failure");
+
+	struct hv_24x7_request_buffer *rqb = (void *)call->req;
+	struct hv_24x7_data_result_buffer *rsb = (void *)call->res;
+	rqb->interface_version = HV_24X7_IF_VERSION_V1;
+	rsb->interface_version = HV_24X7_IF_VERSION_V1;
+	rsb->catalog_version_num = c->page_0->version;
+	return call;
+}
+
+/* Add a request for indexes @first to @last of @g, and its (zeroed) result */
+static void synth_call_add(struct synth_call *call, unsigned domain,
+		struct hv_24x7_group_data *g, unsigned first, unsigned last)
+{
+	unsigned data_size = be_to_cpu(g->event_group_record_len), ix;
+	size_t n = ((struct hv_24x7_request_buffer *)call->req)->num_requests;
+	size_t res_add = sizeof(struct hv_24x7_result) + (size_t)(last - first + 1) *
+		(sizeof(struct hv_24x7_result_element) + data_size);
+
+	call->req = realloc(call->req, call->req_len + sizeof(struct hv_24x7_request));
+	call->res = realloc(call->res, call->res_len + res_add);
+	call->groups = realloc(call->groups, sizeof(*call->groups) * (n + 1));
+	if (!call->req || !call->res || !call->groups)
+		err(1, "alloc failure");
+
+	struct hv_24x7_request_buffer *rqb = (void *)call->req;
+	struct hv_24x7_data_result_buffer *rsb = (void *)call->res;
+	rqb->requests[n] = (struct hv_24x7_request) {
+		.performance_domain = domain,
+		.data_size = g->event_group_record_len,
+		.data_offset = cpu_to_be32(be_to_cpu(g->event_group_record_offs)),
+		.starting_lpar_ix = cpu_to_be16(0xffff),
+		.max_num_lpars = cpu_to_be16(1),
+		.starting_ix = cpu_to_be16(first),
+		.max_ix = cpu_to_be16(last),
+	};
+	rqb->num_requests = n + 1;
+	rsb->num_results = n + 1;
+	call->groups[n] = g;
+
+	unsigned char *p = call->res + call->res_len;
+	memset(p, 0, res_add);
+	struct hv_24x7_result *r = (void *)p;
+	r->result_ix = n;
+	r->results_complete = 1;
+	r->num_elements_returned = cpu_to_be16(last - first + 1);
+	r->result_element_data_size = g->event_group_record_len;
+	p += sizeof(*r);
+
+	for (ix = first; ix <= last; ix++) {
+		struct hv_24x7_result_element *e = (void *)p;
+		e->domain_ix = cpu_to_be16(ix);
+		e->lpar_cfg_instance_id = cpu_to_be32(0xffffffff);
+		p += sizeof(*e) + data_size;
+	}
+
+	call->req_len += sizeof(struct hv_24x7_request);
+	call->res_len += res_add;
+}
+
+static int cmd_synth(int argc, char **argv)
+{
+	unsigned domain = HV_PERF_DOMAIN_PHYSICAL_CORE, indexes = 16;
+	unsigned long group_max = 32, intervals = 1000, period_us = 1000000, i;
+	size_t result_max = 4096, j, k;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:g:i:n:P:r:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			domain = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			group_max = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			indexes = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			intervals = strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			period_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			result_max = strtoull(optarg, NULL, 0);
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (argc - optind != 2)
+		U(1);
+
+	if (domain < HV_PERF_DOMAIN_PHYSICAL_CHIP ||
+			domain > HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_REMOTE_NODE)
+		errx(1, "unknown domain %u", domain);
+	if (!indexes || indexes > UINT16_MAX)
+		errx(1, "indexes must be 1-%u", UINT16_MAX);
+
+	struct catalog c;
+	if (catalog_load(&c, argv[optind]))
+		return 1;
+
+	/*
+	 * Like hv-collect, split the groups and indexes over as many calls as
+	 * it takes for each call's results to fit in @result_max.
+	 */
+	unsigned group_domain = domain == HV_PERF_DOMAIN_PHYSICAL_CHIP ?
+		HV_PERF_DOMAIN_PHYSICAL_CHIP : HV_PERF_DOMAIN_PHYSICAL_CORE;
+	struct synth_call *calls = NULL, *call = NULL;
+	size_t call_count = 0, group_count = 0;
+	for (j = 0; j < c.group_count && group_count < group_max; j++) {
+		struct hv_24x7_group_data *g = c.groups[j];
+		size_t len = be_to_cpu(g->event_group_record_len);
+		if (g->domain != group_domain || g->group_schema_ix >= c.schema_count ||
+				!len || !IS_ALIGNED(len, 8))
+			continue;
+
+		size_t element = sizeof(struct hv_24x7_result_element) + len;
+		size_t fixed = sizeof(struct hv_24x7_data_result_buffer) + sizeof(struct hv_24x7_result);
+		if (fixed + element > result_max) {
+			pr_debug(1, "group %zu does not fit in a %zu byte result", j, result_max);
+			continue;
+		}
+		size_t per_request = (result_max - fixed) / element;
+		group_count++;
+
+		unsigned ix = 0;
+		while (ix < indexes) {
+			unsigned end = indexes - ix > per_request ? ix + per_request - 1 : indexes - 1;
+			size_t need = sizeof(struct hv_24x7_result) + (end - ix + 1) * element;
+
+			/* num_requests is a byte */
+			if (!call || call->res_len + need > result_max ||
+					((struct hv_24x7_request_buffer *)call->req)->num_requests == UINT8_MAX)
+				call = synth_call_new(&calls, &call_count, &c);
+
+			synth_call_add(call, domain, g, ix, end);
+			ix = end + 1;
+		}
+	}
+
+	if (!group_count)
+		errx(1, "catalog has no usable groups for domain %u", domain);
+	pr_debug(1, "%zu groups in %zu calls", group_count, call_count);
+
+	struct hv_capture_writer *w = hv_capture_create(argv[optind + 1],
+			be_to_cpu(c.page_0->version), c.page_0->build_time_stamp);
+	if (!w)
+		return 1;
+
+	uint64_t rand = 0x2458c7a9d3f1e6b5ULL;
+	for (i = 0; i < intervals; i++) {
+		uint64_t ts = (uint64_t)i * period_us * 1000;
+		for (k = 0; k < call_count; k++) {
+			call = &calls[k];
+			/* the timebase ticks at 512MHz */
+			synth_update(&c, call, ts * 64 / 125, &rand);
+			if (hv_capture_write(w, ts, call->req, call->req_len, call->res, call->res_len))
+				return 1;
+		}
+	}
+
+	int ret = hv_capture_close(w);
+	for (k = 0; k < call_count; k++) {
+		free(calls[k].req);
+		free(calls[k].res);
+		free(calls[k].groups);
+	}
+	free(calls);
+	catalog_free(&c);
+	return !!ret;
+}
+
+static int cmd_info(int argc, char **argv)
+{
+	const void *req, *res;
+	size_t req_len, res_len;
+	uint64_t ts, first_ts = 0, last_ts = 0, records = 0, bytes = 0;
+	int ret;
+
+	if (argc != 2)
+		U(1);
+
+	struct hv_capture_reader *r = hv_capture_open(argv[1]);
+	if (!r)
+		return 1;
+
+	printf("catalog_version: %"PRIu64"\n", hv_capture_catalog_version(r));
+	while ((ret = hv_capture_next(r, &ts, &req, &req_len, &res, &res_len)) == 1) {
+		const struct hv_24x7_request_buffer *rb = req;
+		if (!records) {
+			first_ts = ts;
+			if (req_len >= sizeof(*rb))
+				printf("requests: %u per call\n", rb->num_requests);
+		}
+		last_ts = ts;
+		records++;
+		bytes += req_len + res_len;
+	}
+
+	printf("records: %"PRIu64" (%"PRIu64" bytes of buffers)\n", records, bytes);
+	if (records)
+		printf("duration: %.3f s\n", (last_ts - first_ts) / 1e9);
+
+	hv_capture_reader_close(r);
+	return ret < 0;
+}
+
+int main(int argc, char **argv)
+{
+	err_set_progname(PRGM_NAME);
+
+	if (argc < 2)
+		U(1);
+
+	/* let each command's getopt see its own options */
+	const char *cmd = argv[1];
+	argv[1] = argv[0];
+	argc--;
+	argv++;
+
+	if (!strcmp(cmd, "replay"))
+		return cmd_replay(argc, argv);
+	if (!strcmp(cmd, "synth"))
+		return cmd_synth(argc, argv);
+	if (!strcmp(cmd, "info"))
+		return cmd_info(argc, argv);
+	if (!strcmp(cmd, "-h"))
+		U(0);
+	U(1);
+}
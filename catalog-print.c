@@ -0,0 +1,300 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+#include <ccan/endian/endian.h>
+
+#include <penny/penny.h>
+#include <penny/math.h>
+#include <penny/print.h>
+
+#include "catalog.h"
+
+static size_t domain_to_string(enum hv_perf_domains domain, char *buf, size_t buf_len)
+{
+	size_t l;
+	switch (domain) {
+#define DOMAIN(n, v, x)				\
+	case HV_PERF_DOMAIN_##n:		\
+		l = min(strlen(#n), buf_len - 1);	\
+		memcpy(buf, #n, l);		\
+		buf[l] = '\0';			\
+		break;
+#include "hv-24x7-domains.h"
+#undef DOMAIN
+	default:
+		l = snprintf(buf, buf_len, "unknown[%d]", domain);
+	}
+
+	return l;
+}
+
+static void print_event_fmt(struct hv_24x7_event_data *event, unsigned domain, FILE *o)
+{
+	const char *lpar;
+	if (is_physical_domain(domain))
+		lpar = "0x0";
+	else
+		lpar = "sibling_guest_id";
+
+	fprintf(o, "domain=0x%x,offset=0x%x,starting_index=%s,lpar=%s\n",
+			domain,
+			event_offset(event),
+			domain_to_index_string(domain),
+			lpar);
+}
+
+static void print_event_for_all_domains(struct hv_24x7_event_data *event, FILE *o)
+{
+	unsigned domains[CATALOG_EVENT_DOMAINS_MAX];
+	size_t i, domain_count;
+	size_t nl;
+	char *name = event_name(event, &nl);
+	fprintf(o, "%.*s:\n", (int)nl, name);
+	domain_count = event_domains(event, domains);
+	if (!domain_count)
+		pr_debug(1, "Whoops");
+	for (i = 0; i < domain_count; i++)
+		print_event_fmt(event, domains[i], o);
+}
+
+static void print_event(struct hv_24x7_event_data *event, struct hv_24x7_group_data **group_index, size_t group_count, FILE *o)
+{
+	size_t name_len, desc_len, long_desc_len, group_name_len;
+	const char *name, *desc, *long_desc, *group_name_;
+	char domain[1024];
+
+	print_event_for_all_domains(event, o);
+
+	if (!debug_is(5))
+		return;
+
+	name = event_name(event, &name_len);
+	desc = event_desc(event, &desc_len);
+	long_desc = event_long_desc(event, &long_desc_len);
+	size_t group_ix = be_to_cpu(event->primary_group_ix);
+	if (group_ix >= group_count) {
+		group_name_ = "UNKNOWN";
+		group_name_len = strlen(group_name_);
+	} else {
+		group_name_ = group_name(group_index[group_ix], &group_name_len);
+	}
+
+	domain_to_string(event->domain, domain, sizeof(domain));
+
+	fprintf(o, "event {\n"
+		"	.length = %u,\n"
+		"	.domain = %s /* %u */,\n"
+		"	.event_group_record_offs = %u,\n"
+		"	.event_group_record_len = %u,\n"
+		"	.event_counter_offs = %u,\n"
+		"	.flags = %"PRIx32",\n"
+		"	.primary_group_ix = \"",
+		be_to_cpu(event->length),
+		domain, event->domain,
+		be_to_cpu(event->event_group_record_offs),
+		be_to_cpu(event->event_group_record_len),
+		be_to_cpu(event->event_counter_offs),
+		be_to_cpu(event->flags));
+
+	print_bytes_as_cstring_(group_name_, group_name_len, o);
+
+	fprintf(o, "\" /* %u */,\n"
+		"	.group_count = %u,\n"
+		"	.name = \"",
+		be_to_cpu(event->primary_group_ix),
+		be_to_cpu(event->group_count));
+
+	print_bytes_as_cstring_(name, name_len, o);
+
+	fprintf(o, "\", /* %zu */\n"
+		"	.desc = \"",
+		name_len);
+
+	print_bytes_as_cstring_(desc, desc_len, o);
+
+	fprintf(o, "\", /* %zu */\n"
+		"	.detailed_desc = \"",
+		desc_len);
+
+	print_bytes_as_cstring_(long_desc, long_desc_len, o);
+
+	fprintf(o, "\", /* %zu */\n"
+		"}\n",
+		long_desc_len);
+
+	if (debug_is(100))
+		print_hex_dump_fmt(event, be_to_cpu(event->length), o);
+}
+
+static void print_group(struct hv_24x7_group_data *group, FILE *o)
+{
+	size_t name_len, desc_len;
+	char *name, *desc;
+	char domain[1024];
+
+	domain_to_string(group->domain, domain, sizeof(domain));
+	name = group_name(group, &name_len);
+	desc = group_desc(group, &desc_len);
+
+	fprintf(o, "group {\n"
+		"	.length = %u,\n"
+		"	.flags = %"PRIx32",\n"
+		"	.domain = %s /* %u */,\n"
+		"	.event_group_record_offs = %u,\n"
+		"	.event_group_record_len = %u,\n"
+		"	.group_schema_index = %u,\n"
+		"	.event_count = %u,\n"
+		"	.event_indexes = {%u, %u, %u, %u, %u, %u, %u, %u, %u, %u, %u, %u, %u, %u, %u, %u},\n"
+		"	.name = \"",
+		be_to_cpu(group->length),
+		be_to_cpu(group->flags),
+		domain, group->domain,
+		be_to_cpu(group->event_group_record_offs),
+		be_to_cpu(group->event_group_record_len),
+		be_to_cpu(group->group_schema_ix),
+		be_to_cpu(group->event_count),
+		be_to_cpu(group->event_ixs[0]),
+		be_to_cpu(group->event_ixs[1]),
+		be_to_cpu(group->event_ixs[2]),
+		be_to_cpu(group->event_ixs[3]),
+		be_to_cpu(group->event_ixs[4]),
+		be_to_cpu(group->event_ixs[5]),
+		be_to_cpu(group->event_ixs[6]),
+		be_to_cpu(group->event_ixs[7]),
+		be_to_cpu(group->event_ixs[8]),
+		be_to_cpu(group->event_ixs[9]),
+		be_to_cpu(group->event_ixs[10]),
+		be_to_cpu(group->event_ixs[11]),
+		be_to_cpu(group->event_ixs[12]),
+		be_to_cpu(group->event_ixs[13]),
+		be_to_cpu(group->event_ixs[14]),
+		be_to_cpu(group->event_ixs[15]));
+
+	print_bytes_as_cstring_(name, name_len, o);
+
+	fprintf(o , "\", /* %zu */\n"
+		"	.desc = \"", name_len);
+
+	print_bytes_as_cstring_(desc, desc_len, o);
+
+	fprintf(o, "\", /* %zu */\n"
+		"}\n", desc_len);
+}
+
+static void print_schema_field_entry(struct hv_24x7_grs_field *field, FILE *o)
+{
+	fprintf(o, "		{\n"
+		"			.enum = %u,\n"
+		"			.offs = %u,\n"
+		"			.length = %u,\n"
+		"			.flags = 0x%X,\n"
+		"		},\n",
+		be_to_cpu(field->field_enum),
+		be_to_cpu(field->offs),
+		be_to_cpu(field->length),
+		be_to_cpu(field->flags));
+}
+
+static void print_schema(struct hv_24x7_grs *schema, FILE *o)
+{
+	size_t length = be_to_cpu(schema->length);
+	size_t field_entry_count = be_to_cpu(schema->field_entry_count);
+
+	fprintf(o, "schema {\n"
+		"	.length = %zu,\n"
+		"	.descriptor = %u,\n"
+		"	.version_id = %u,\n"
+		"	.field_entry_count = %zu,\n"
+		"	.field_entries = {\n",
+		length,
+		be_to_cpu(schema->descriptor),
+		be_to_cpu(schema->version_id),
+		field_entry_count);
+
+	struct hv_24x7_grs_field *field = (void *)schema->field_entrys;
+	size_t i = 0;
+	size_t offset;
+	for (;;) {
+		offset = (void *)field - (void *)schema;
+		if (offset >= length)
+			break;
+
+		if (i >= field_entry_count) {
+			pr_debug(1, "schema has padding of %zu bytes", length - offset);
+			break;
+		}
+		fprintf(o, "\t\t[%zu] = ", i);
+
+		print_schema_field_entry(field, o);
+
+		field++;
+		i ++;
+	}
+
+	if (i != field_entry_count)
+		warnx("schema ended before listed # of fields were parsed (got %zu, wanted %zu, offset %zu, length %zu)", i, field_entry_count, offset, length);
+
+	fprintf(o, "	}\n"
+		   "}\n");
+}
+
+void catalog_print(struct catalog *c, FILE *o)
+{
+	struct hv_24x7_catalog_page_0 *p0 = c->page_0;
+	size_t i;
+
+	for (i = 0; i < c->schema_count; i++) {
+		struct hv_24x7_grs *schema = c->schemas[i];
+		size_t schema_len = be_to_cpu(schema->length);
+		size_t offset = (void *)schema - (void *)c->schemas[0];
+
+		if (debug_is(1))
+			fprintf(o, "/* schema %zu of %u: len=%zu offset=%zu */\n", i,
+					(unsigned)be_to_cpu(p0->schema_entry_count),
+					schema_len, offset);
+
+		if (!IS_ALIGNED(schema_len, 16))
+			fprintf(o, "/* missaligned */\n");
+
+		if (debug_is(1))
+			print_schema(schema, o);
+	}
+
+	for (i = 0; i < c->group_count; i++) {
+		struct hv_24x7_group_data *group = c->groups[i];
+
+		if (!IS_ALIGNED((size_t)be_to_cpu(group->length), 16))
+			fprintf(o, "/* missaligned */\n");
+
+		if (debug_is(1))
+			print_group(group, o);
+	}
+
+	for (i = 0; i < c->event_count; i++) {
+		struct catalog_event *ev = &c->events[i];
+		size_t ev_len = be_to_cpu(ev->data->length);
+
+		fprintf(o, "/* event %zu of %u: len=%zu offset=%zu */\n", ev->ix,
+				(unsigned)be_to_cpu(p0->event_entry_count),
+				ev_len, ev->offset);
+
+		if (!IS_ALIGNED(ev_len, 16))
+			fprintf(o, "/* missaligned */\n");
+
+		print_event(ev->data, c->groups, c->group_count, o);
+	}
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+#include <ccan/endian/endian.h>
+
+#include <penny/penny.h>
+
+#include "catalog-watch.h"
+
+struct catalog_reader {
+	struct catalog_watch *w;
+	/* epoch at the last catalog_reader_lock(), 0 when unlocked */
+	uint64_t epoch;
+	int in_use;
+} __attribute__((aligned(64)));
+
+struct catalog_watch {
+	char *catalog_file;
+	char *version_file;
+	unsigned interval_ms;
+
+	struct catalog_snapshot *current;
+	uint64_t epoch;
+
+	struct catalog_reader *readers;
+	unsigned max_readers;
+
+	pthread_t thread;
+	int stop_pipe[2];
+	int inotify_fd;
+};
+
+static int read_version(struct catalog_watch *w, uint64_t *version)
+{
+	if (w->version_file) {
+		char buf[64];
+		FILE *f = fopen(w->version_file, "r");
+		if (!f) {
+			warn("could not open %s", w->version_file);
+			return -1;
+		}
+		size_t r = fread(buf, 1, sizeof(buf) - 1, f);
+		fclose(f);
+		buf[r] = '\0';
+		*version = strtoull(buf, NULL, 0);
+		return 0;
+	}
+
+	struct hv_24x7_catalog_page_0 p0;
+	FILE *f = fopen(w->catalog_file, "rb");
+	if (!f) {
+		warn("could not open %s", w->catalog_file);
+		return -1;
+	}
+	size_t r = fread(&p0, 1, sizeof(p0), f);
+	fclose(f);
+	if (r != sizeof(p0)) {
+		warnx("could not read page 0 of %s", w->catalog_file);
+		return -1;
+	}
+	*version = be_to_cpu(p0.version);
+	return 0;
+}
+
+static struct catalog_snapshot *snapshot_build(struct catalog_watch *w, uint64_t version)
+{
+	struct catalog_snapshot *s = malloc(sizeof(*s));
+	if (!s) {
+		warnx("alloc failure");
+		return NULL;
+	}
+
+	if (catalog_load(&s->catalog, w->catalog_file)) {
+		free(s);
+		return NULL;
+	}
+
+	s->version = version;
+	pr_debug(1, "built catalog snapshot for version %"PRIu64" (%zu events)",
+			version, s->catalog.event_count);
+	return s;
+}
+
+static void snapshot_free(struct catalog_snapshot *s)
+{
+	catalog_free(&s->catalog);
+	free(s);
+}
+
+/* Wait until no reader can still be using a snapshot retired before @epoch */
+static void wait_for_readers(struct catalog_watch *w, uint64_t epoch)
+{
+	unsigned i;
+	for (i = 0; i < w->max_readers; i++) {
+		struct catalog_reader *r = &w->readers[i];
+		for (;;) {
+			uint64_t e = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST);
+			if (!e || e >= epoch)
+				break;
+			nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+		}
+	}
+}
+
+/* Returns false when asked to stop */
+static bool wait_for_change(struct catalog_watch *w)
+{
+	struct pollfd fds[2] = {
+		{ .fd = w->stop_pipe[0], .events = POLLIN },
+		{ .fd = w->inotify_fd, .events = POLLIN },
+	};
+	nfds_t nfds = w->inotify_fd == -1 ? 1 : 2;
+
+	int r = poll(fds, nfds, w->interval_ms);
+	if (r < 0 && errno != EINTR)
+		warn("poll");
+
+	if (fds[0].revents)
+		return false;
+
+	if (nfds > 1 && fds[1].revents) {
+		char buf[4096];
+		while (read(w->inotify_fd, buf, sizeof(buf)) > 0)
+			;
+		/* the file may have been replaced rather than modified */
+		if (inotify_add_watch(w->inotify_fd, w->version_file,
+				IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF) == -1)
+			pr_debug(1, "could not re-add inotify watch on %s", w->version_file);
+	}
+
+	return true;
+}
+
+static void *watch_thread(void *arg)
+{
+	struct catalog_watch *w = arg;
+
+	while (wait_for_change(w)) {
+		uint64_t version;
+		if (read_version(w, &version) || version == w->current->version)
+			continue;
+
+		pr_debug(1, "catalog version changed: %"PRIu64" -> %"PRIu64,
+				w->current->version, version);
+
+		/* on failure, keep the old one and try again next time */
+		struct catalog_snapshot *n = snapshot_build(w, version);
+		if (!n)
+			continue;
+
+		struct catalog_snapshot *old = __atomic_exchange_n(&w->current, n, __ATOMIC_SEQ_CST);
+		uint64_t epoch = __atomic_add_fetch(&w->epoch, 1, __ATOMIC_SEQ_CST);
+		wait_for_readers(w, epoch);
+		snapshot_free(old);
+	}
+
+	return NULL;
+}
+
+static char *strdup_or_null(const char *s)
+{
+	char *d;
+	if (!s)
+		return NULL;
+	d = strdup(s);
+	if (!d)
+		err(1, "alloc failure");
+	return d;
+}
+
+struct catalog_watch *catalog_watch_start(const char *catalog_file,
+		const char *version_file, unsigned interval_ms, unsigned max_readers)
+{
+	struct catalog_watch *w = calloc(1, sizeof(*w));
+	uint64_t version;
+	int r;
+
+	if (!w)
+		err(1, "alloc failure");
+
+	w->catalog_file = strdup_or_null(catalog_file);
+	w->version_file = strdup_or_null(version_file);
+	w->interval_ms = interval_ms;
+	w->epoch = 1;
+	w->max_readers = max_readers;
+	w->inotify_fd = -1;
+
+	if (posix_memalign((void **)&w->readers, 64, sizeof(*w->readers) * max_readers))
+		err(1, "alloc failure");
+	memset(w->readers, 0, sizeof(*w->readers) * max_readers);
+
+	if (read_version(w, &version))
+		goto err;
+	w->current = snapshot_build(w, version);
+	if (!w->current)
+		goto err;
+
+	if (pipe(w->stop_pipe))
+		err(1, "could not create pipe");
+
+	if (version_file) {
+		w->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (w->inotify_fd != -1 && inotify_add_watch(w->inotify_fd, version_file,
+				IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF) == -1) {
+			pr_debug(1, "inotify unavailable for %s, polling", version_file);
+			close(w->inotify_fd);
+			w->inotify_fd = -1;
+		}
+	}
+
+	r = pthread_create(&w->thread, NULL, watch_thread, w);
+	if (r) {
+		errno = r;
+		err(1, "could not create catalog watch thread");
+	}
+
+	return w;
+
+err:
+	free(w->readers);
+	free(w->catalog_file);
+	free(w->version_file);
+	free(w);
+	return NULL;
+}
+
+/* All readers must be unregistered first */
+void catalog_watch_stop(struct catalog_watch *w)
+{
+	if (write(w->stop_pipe[1], "", 1) != 1)
+		warn("could not stop catalog watch thread");
+	pthread_join(w->thread, NULL);
+
+	close(w->stop_pipe[0]);
+	close(w->stop_pipe[1]);
+	if (w->inotify_fd != -1)
+		close(w->inotify_fd);
+
+	snapshot_free(w->current);
+	free(w->readers);
+	free(w->catalog_file);
+	free(w->version_file);
+	free(w);
+}
+
+struct catalog_reader *catalog_reader_register(struct catalog_watch *w)
+{
+	unsigned i;
+	for (i = 0; i < w->max_readers; i++) {
+		struct catalog_reader *r = &w->readers[i];
+		int unused = 0;
+		if (__atomic_compare_exchange_n(&r->in_use, &unused, 1, false,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			r->w = w;
+			return r;
+		}
+	}
+
+	return NULL;
+}
+
+void catalog_reader_unregister(struct catalog_reader *r)
+{
+	__atomic_store_n(&r->epoch, 0, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Announcing the epoch before loading the pointer is what makes this safe:
+ * if the writer's scan missed our announcement, our load of @current comes
+ * after its swap and so returns the new snapshot.
+ */
+const struct catalog_snapshot *catalog_reader_lock(struct catalog_reader *r)
+{
+	struct catalog_watch *w = r->w;
+	__atomic_store_n(&r->epoch, __atomic_load_n(&w->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&w->current, __ATOMIC_SEQ_CST);
+}
+
+void catalog_reader_unlock(struct catalog_reader *r)
+{
+	__atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef CATALOG_WATCH_H_
+#define CATALOG_WATCH_H_
+
+#include <stdint.h>
+
+#include "catalog.h"
+
+/*
+ * Keep a decoded catalog up to date for long running consumers.
+ *
+ * A background thread watches the catalog version (by default the sysfs
+ * 'catalog_version' file, via inotify where it works and by polling
+ * otherwise). When it changes, the catalog is re-read and decoded off to the
+ * side and then published with a single pointer swap.
+ *
+ * Readers never block: catalog_reader_lock() announces the current epoch in
+ * the reader's own slot and loads the pointer. An old catalog is only freed
+ * once every reader has either unlocked or locked again after the swap.
+ */
+
+struct catalog_snapshot {
+	struct catalog catalog;
+	/* the version we saw when this snapshot was built */
+	uint64_t version;
+};
+
+struct catalog_watch;
+struct catalog_reader;
+
+/*
+ * @version_file may be NULL, in which case the version in page 0 of
+ * @catalog_file is polled instead. Up to @max_readers readers may be
+ * registered at once.
+ *
+ * Returns NULL if the initial catalog can't be loaded.
+ */
+struct catalog_watch *catalog_watch_start(const char *catalog_file,
+		const char *version_file, unsigned interval_ms, unsigned max_readers);
+void catalog_watch_stop(struct catalog_watch *w);
+
+/* Returns NULL if all reader slots are in use */
+struct catalog_reader *catalog_reader_register(struct catalog_watch *w);
+void catalog_reader_unregister(struct catalog_reader *r);
+
+/*
+ * The snapshot stays valid until the matching catalog_reader_unlock(). Lock
+ * and unlock do not nest.
+ */
+const struct catalog_snapshot *catalog_reader_lock(struct catalog_reader *r);
+void catalog_reader_unlock(struct catalog_reader *r);
+
+#endif
@@ -0,0 +1,776 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/err/err.h>
+#include <ccan/endian/endian.h>
+
+#include <penny/penny.h>
+#include <penny/math.h>
+
+#include "catalog.h"
+
+bool is_physical_domain(enum hv_perf_domains domain)
+{
+	return domain == HV_PERF_DOMAIN_PHYSICAL_CHIP ||
+		domain == HV_PERF_DOMAIN_PHYSICAL_CORE;
+}
+
+const char *domain_to_index_string(enum hv_perf_domains domain)
+{
+	switch (domain) {
+#define DOMAIN(n, v, x)				\
+	case HV_PERF_DOMAIN_##n:		\
+		return #x;
+#include "hv-24x7-domains.h"
+#undef DOMAIN
+	default:
+		warnx("unknown domain %d", domain);
+		return "unknown";
+	}
+}
+
+char *event_name(struct hv_24x7_event_data *ev, size_t *len)
+{
+	*len = be_to_cpu(ev->event_name_len) - 2;
+	return (char *)ev->remainder;
+}
+
+char *event_desc(struct hv_24x7_event_data *ev, size_t *len)
+{
+	unsigned nl = be_to_cpu(ev->event_name_len);
+	__be16 *desc_len = (__be16 *)(ev->remainder + nl - 2);
+	*len = be_to_cpu(*desc_len) - 2;
+	return (char *)ev->remainder + nl;
+}
+
+char *event_long_desc(struct hv_24x7_event_data *ev, size_t *len)
+{
+	unsigned nl = be_to_cpu(ev->event_name_len);
+	__be16 *desc_len_ = (__be16 *)(ev->remainder + nl - 2);
+	unsigned desc_len = be_to_cpu(*desc_len_);
+	__be16 *long_desc_len = (__be16 *)(ev->remainder + nl + desc_len - 2);
+	*len = be_to_cpu(*long_desc_len) - 2;
+	return (char *)ev->remainder + nl + desc_len;
+}
+
+/* The offset used in the 'offset=' field of the event's perf format */
+unsigned event_offset(struct hv_24x7_event_data *ev)
+{
+	return be_to_cpu(ev->event_counter_offs) +
+		be_to_cpu(ev->event_group_record_offs);
+}
+
+static unsigned core_domains[] = {
+	HV_PERF_DOMAIN_PHYSICAL_CORE,
+	HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_HOME_CORE,
+	HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_HOME_CHIP,
+	HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_HOME_NODE,
+	HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_REMOTE_NODE,
+};
+
+/*
+ * Core events can be collected in any of the core/virtual processor domains,
+ * chip events only in the chip domain.
+ */
+size_t event_domains(struct hv_24x7_event_data *ev, unsigned *domains)
+{
+	switch (ev->domain) {
+	case HV_PERF_DOMAIN_PHYSICAL_CHIP:
+		domains[0] = ev->domain;
+		return 1;
+	case HV_PERF_DOMAIN_PHYSICAL_CORE:
+		memcpy(domains, core_domains, sizeof(core_domains));
+		return ARRAY_SIZE(core_domains);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * The kernel names the aliases for an event in its non-default domains
+ * "<event name>__<suffix>".
+ */
+const char *domain_alias_suffix(enum hv_perf_domains domain)
+{
+	switch (domain) {
+	case HV_PERF_DOMAIN_PHYSICAL_CHIP:
+		return "phys_chip";
+	case HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_HOME_CORE:
+		return "vcpu_home_core";
+	case HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_HOME_CHIP:
+		return "vcpu_home_chip";
+	case HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_HOME_NODE:
+		return "vcpu_home_node";
+	case HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_REMOTE_NODE:
+		return "vcpu_remote_node";
+	default:
+		return NULL;
+	}
+}
+
+static bool event_fixed_portion_is_within(struct hv_24x7_event_data *ev, void *end)
+{
+	void *start = ev;
+	return (start + offsetof(struct hv_24x7_event_data, remainder)) < end;
+}
+
+/*
+ * Things we don't check:
+ *  - padding for desc, name, and long/detailed desc is required to be '\0' bytes.
+ */
+static bool event_is_within(struct hv_24x7_event_data *ev, void *end)
+{
+	unsigned nl = be_to_cpu(ev->event_name_len);
+	void *start = ev;
+	if (nl < 2) {
+		pr_debug(1, "%s: name length too short: %d", __func__, nl);
+		return false;
+	}
+
+	if (start + nl > end) {
+		pr_debug(1, "%s: start=%p + nl=%u > end=%p", __func__, start, nl, end);
+		return false;
+	}
+
+	__be16 *dl_ = (__be16 *)(ev->remainder + nl - 2);
+	if (!IS_ALIGNED((uintptr_t)dl_, 2))
+		warnx("desc len not aligned %p", dl_);
+	unsigned dl = be_to_cpu(*dl_);
+	if (dl < 2) {
+		pr_debug(1, "%s: desc len too short: %d", __func__, dl);
+		return false;
+	}
+
+	if (start + nl + dl > end) {
+		pr_debug(1, "%s: (start=%p + nl=%u + dl=%u)=%p > end=%p", __func__, start, nl, dl, start + nl + dl, end);
+		return false;
+	}
+
+	__be16 *ldl_ = (__be16 *)(ev->remainder + nl + dl - 2);
+	if (!IS_ALIGNED((uintptr_t)ldl_, 2))
+		warnx("long desc len not aligned %p", ldl_);
+	unsigned ldl = be_to_cpu(*ldl_);
+	if (ldl < 2) {
+		pr_debug(1, "%s: long desc len too short (ldl=%u)", __func__, ldl);
+		return false;
+	}
+
+	if (start + nl + dl + ldl > end) {
+		pr_debug(1, "%s: start=%p + nl=%u + dl=%u + ldl=%u > end=%p", __func__, start, nl, dl, ldl, end);
+		return false;
+	}
+
+	return true;
+}
+
+char *group_name(struct hv_24x7_group_data *group, size_t *len)
+{
+	*len = be_to_cpu(group->group_name_len) - 2;
+	return (char *)group->remainder;
+}
+
+char *group_desc(struct hv_24x7_group_data *group, size_t *len)
+{
+	unsigned nl = be_to_cpu(group->group_name_len);
+	__be16 *desc_len = (__be16 *)(group->remainder + nl - 2);
+	*len = be_to_cpu(*desc_len) - 2;
+	return (char *)group->remainder + nl;
+}
+
+static bool group_fixed_portion_is_within(struct hv_24x7_group_data *group, void *end)
+{
+	void *start = group;
+	return (start + sizeof(*group)) < end;
+}
+
+static bool group_is_within(struct hv_24x7_group_data *group, void *end)
+{
+	unsigned nl = be_to_cpu(group->group_name_len);
+	void *start = group;
+	if (nl < 2) {
+		pr_debug(1, "%s: name length too short: %d", __func__, nl);
+		return false;
+	}
+
+	if (start + nl > end) {
+		pr_debug(1, "%s: start=%p + nl=%u > end=%p", __func__, start, nl, end);
+		return false;
+	}
+
+	unsigned dl = be_to_cpu(*((__be16*)(group->remainder + nl - 2)));
+	if (dl < 2) {
+		pr_debug(1, "%s: desc len too short: %d", __func__, dl);
+		return false;
+	}
+
+	if (start + nl + dl > end) {
+		pr_debug(1, "%s: (start=%p + nl=%u + dl=%u)=%p > end=%p", __func__, start, nl, dl, start + nl + dl, end);
+		return false;
+	}
+
+	return true;
+}
+
+static bool schema_fixed_portion_is_within(struct hv_24x7_grs *schema, void *end)
+{
+	void *start = schema;
+	return (start + sizeof(*schema)) < end;
+}
+
+static bool schema_is_within(struct hv_24x7_grs *schema, void *end)
+{
+	unsigned field_entry_count = be_to_cpu(schema->field_entry_count);
+	void *start = schema;
+	if (!field_entry_count) {
+		pr_debug(1, "%s: no field entries", __func__);
+		return false;
+	}
+
+	size_t field_entry_bytes = field_entry_count * sizeof(schema->field_entrys[0]);
+
+	if (start + field_entry_bytes > end) {
+		pr_debug(1, "%s: start=%p + field_entry_bytes=%zu > end=%p", __func__, start, field_entry_bytes, end);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Locate a section of the catalog given its offset and length in pages.
+ * Returns NULL if the section does not fit in the catalog.
+ */
+static void *catalog_section(struct catalog *c, const char *name,
+		unsigned offs, unsigned len, size_t *bytes)
+{
+	size_t start = (size_t)offs * CATALOG_PAGE_SIZE;
+	*bytes = (size_t)len * CATALOG_PAGE_SIZE;
+	if (start > c->len || *bytes > c->len - start) {
+		warnx("%s data (pages %u + %u) exceeds catalog length %zu", name, offs, len, c->len);
+		return NULL;
+	}
+
+	return c->data + start;
+}
+
+static int decode_schemas(struct catalog *c)
+{
+	struct hv_24x7_catalog_page_0 *p0 = c->page_0;
+	unsigned schema_entry_count = be_to_cpu(p0->schema_entry_count);
+	size_t schema_data_bytes;
+	void *schema_data = catalog_section(c, "schema",
+			be_to_cpu(p0->schema_data_offs),
+			be_to_cpu(p0->schema_data_len),
+			&schema_data_bytes);
+	if (!schema_data)
+		return -1;
+
+	c->schemas = malloc(sizeof(*c->schemas) * schema_entry_count);
+	if (!c->schemas && schema_entry_count) {
+		warnx("alloc failure schema index");
+		return -1;
+	}
+
+	struct hv_24x7_grs *schema = schema_data;
+	void *end = schema_data + schema_data_bytes;
+	size_t i;
+	for (i = 0; ; i++) {
+		if (!schema_fixed_portion_is_within(schema, end)) {
+			warnx("schema fixed portion is not within range");
+			break;
+		}
+
+		size_t offset = (void *)schema - schema_data;
+		if (offset >= schema_data_bytes)
+			break;
+
+		if (i >= schema_entry_count) {
+			/* Padding follows the last schema, this is expected */
+			pr_debug(2, "schema count ends before buffer end (offset=%zu, bytes remaining=%zu)\n",
+					offset, schema_data_bytes - offset);
+			break;
+		}
+
+		size_t schema_len = be_to_cpu(schema->length);
+		void *schema_end = (__u8 *)schema + schema_len;
+		if (schema_end > end) {
+			warnx("schema ends after schema data: schema_end=%p > end=%p", schema_end, end);
+			break;
+		}
+
+		if (!schema_is_within(schema, end)) {
+			warnx("schema exceeds schema data length schema=%p end=%p", schema, end);
+			break;
+		}
+
+		if (!schema_is_within(schema, schema_end)) {
+			warnx("schema exceeds it's own length schema=%p end=%p", schema, schema_end);
+			break;
+		}
+
+		c->schemas[i] = schema;
+		schema = (void *)schema + schema_len;
+	}
+
+	c->schema_count = i;
+	return 0;
+}
+
+static int decode_groups(struct catalog *c)
+{
+	struct hv_24x7_catalog_page_0 *p0 = c->page_0;
+	unsigned group_entry_count = be_to_cpu(p0->group_entry_count);
+	size_t group_data_bytes;
+	void *group_data = catalog_section(c, "group",
+			be_to_cpu(p0->group_data_offs),
+			be_to_cpu(p0->group_data_len),
+			&group_data_bytes);
+	if (!group_data)
+		return -1;
+
+	c->groups = malloc(sizeof(*c->groups) * group_entry_count);
+	if (!c->groups && group_entry_count) {
+		warnx("alloc failure group_index");
+		return -1;
+	}
+
+	struct hv_24x7_group_data *group = group_data;
+	void *end = group_data + group_data_bytes;
+	size_t i;
+	for (i = 0; ; i++) {
+		if (!group_fixed_portion_is_within(group, end)) {
+			warnx("group fixed portion is not within range");
+			break;
+		}
+
+		size_t offset = (void *)group - group_data;
+		if (offset >= group_data_bytes)
+			break;
+
+		if (i >= group_entry_count) {
+			/* Padding follows the last group, this is expected */
+			pr_debug(2, "group count ends before buffer end (offset=%zu, bytes remaining=%zu)\n",
+					offset, group_data_bytes - offset);
+			break;
+		}
+
+		size_t group_len = be_to_cpu(group->length);
+		pr_debug(1, "/* group %zu of %u: len=%zu offset=%zu */\n", i, group_entry_count, group_len, offset);
+
+		void *group_end = (__u8 *)group + group_len;
+		if (group_end > end) {
+			warnx("group ends after group data: group_end=%p > end=%p", group_end, end);
+			break;
+		}
+
+		if (!group_is_within(group, end)) {
+			warnx("group exceeds group data length group=%p end=%p", group, end);
+			break;
+		}
+
+		if (!group_is_within(group, group_end)) {
+			warnx("group exceeds it's own length group=%p end=%p", group, group_end);
+			break;
+		}
+
+		c->groups[i] = group;
+		group = (void *)group + group_len;
+	}
+
+	c->group_count = i;
+	return 0;
+}
+
+char *formula_name(struct hv_24x7_formula_data *f, size_t *len)
+{
+	*len = be_to_cpu(f->name_len) - 2;
+	return (char *)f->remainder;
+}
+
+char *formula_desc(struct hv_24x7_formula_data *f, size_t *len)
+{
+	unsigned nl = be_to_cpu(f->name_len);
+	__be16 *desc_len = (__be16 *)(f->remainder + nl - 2);
+	*len = be_to_cpu(*desc_len) - 2;
+	return (char *)f->remainder + nl;
+}
+
+char *formula_text(struct hv_24x7_formula_data *f, size_t *len)
+{
+	unsigned nl = be_to_cpu(f->name_len);
+	__be16 *desc_len_ = (__be16 *)(f->remainder + nl - 2);
+	unsigned desc_len = be_to_cpu(*desc_len_);
+	__be16 *formula_len = (__be16 *)(f->remainder + nl + desc_len - 2);
+	*len = be_to_cpu(*formula_len) - 2;
+	return (char *)f->remainder + nl + desc_len;
+}
+
+/* name, desc and formula, each preceded by its length, all within @end */
+static bool formula_is_within(struct hv_24x7_formula_data *f, void *end)
+{
+	void *p = f->remainder;
+	unsigned l = be_to_cpu(f->name_len), i;
+
+	for (i = 0; i < 3; i++) {
+		if (l < 2) {
+			pr_debug(1, "%s: length %u of field %u too short", __func__, l, i);
+			return false;
+		}
+
+		if (p + l > end) {
+			pr_debug(1, "%s: field %u: p=%p + l=%u > end=%p", __func__, i, p, l, end);
+			return false;
+		}
+
+		p += l;
+		if (i < 2)
+			l = be_to_cpu(*((__be16 *)(p - 2)));
+	}
+
+	return true;
+}
+
+static int decode_formulas(struct catalog *c)
+{
+	struct hv_24x7_catalog_page_0 *p0 = c->page_0;
+	unsigned formula_entry_count = be_to_cpu(p0->formula_entry_count);
+	size_t formula_data_bytes;
+	void *formula_data = catalog_section(c, "formula",
+			be_to_cpu(p0->formula_data_offs),
+			be_to_cpu(p0->formula_data_len),
+			&formula_data_bytes);
+	if (!formula_data)
+		return -1;
+
+	c->formulas = malloc(sizeof(*c->formulas) * formula_entry_count);
+	if (!c->formulas && formula_entry_count) {
+		warnx("alloc failure formula index");
+		return -1;
+	}
+
+	struct hv_24x7_formula_data *formula = formula_data;
+	void *end = formula_data + formula_data_bytes;
+	size_t i;
+	for (i = 0; i < formula_entry_count; i++) {
+		if ((void *)formula + sizeof(*formula) > end) {
+			warnx("formula fixed portion is not within range");
+			break;
+		}
+
+		size_t formula_len = be_to_cpu(formula->length);
+		void *formula_end = (__u8 *)formula + formula_len;
+		if (formula_len < sizeof(*formula) || formula_end > end) {
+			warnx("formula %zu has a bad length %zu", i, formula_len);
+			break;
+		}
+
+		if (!formula_is_within(formula, formula_end)) {
+			warnx("formula exceeds it's own length formula=%p end=%p", formula, formula_end);
+			break;
+		}
+
+		c->formulas[i] = formula;
+		formula = formula_end;
+	}
+
+	c->formula_count = i;
+	return 0;
+}
+
+static int decode_events(struct catalog *c)
+{
+	struct hv_24x7_catalog_page_0 *p0 = c->page_0;
+	unsigned event_entry_count = be_to_cpu(p0->event_entry_count);
+	size_t event_data_bytes;
+	void *event_data = catalog_section(c, "event",
+			be_to_cpu(p0->event_data_offs),
+			be_to_cpu(p0->event_data_len),
+			&event_data_bytes);
+	if (!event_data)
+		return -1;
+
+	c->events = malloc(sizeof(*c->events) * event_entry_count);
+	if (!c->events && event_entry_count) {
+		warnx("alloc failure event index");
+		return -1;
+	}
+
+	struct hv_24x7_event_data *event = event_data;
+	void *end = event_data + event_data_bytes;
+	size_t i, n = 0;
+	for (i = 0; ; i++) {
+		size_t offset = (void *)event - event_data;
+		if (offset >= event_data_bytes)
+			break;
+
+		if (i >= event_entry_count) {
+			/* XXX: we have padding following the last event. Completely expected. */
+			pr_debug(2, "event count ends before buffer end (offset=%zu, end=%zu bytes remaining=%zu)\n",
+					offset, event_data_bytes, event_data_bytes - offset);
+			break;
+		}
+
+		if (!event_fixed_portion_is_within(event, end)) {
+			warnx("event fixed portion is not within range");
+			break;
+		}
+
+		size_t ev_len = be_to_cpu(event->length);
+
+		if (event->event_group_record_len == 0) {
+			pr_debug(10, "invalid event, skipping\n");
+			goto next_event;
+		}
+
+		void *ev_end = (__u8 *)event + ev_len;
+		if (ev_end > end) {
+			warnx("event ends after event data: ev_end=%p > end=%p", ev_end, end);
+			break;
+		}
+
+		if (!event_is_within(event, end)) {
+			warnx("event exceeds event data length event=%p end=%p", event, end);
+			break;
+		}
+
+		if (!event_is_within(event, ev_end)) {
+			warnx("event exceeds it's own length event=%p end=%p", event, ev_end);
+			break;
+		}
+
+		if (!event_is_within(event, PTR_ALIGN(event, 4096))) {
+			warnx("event crosses page boundary");
+		}
+
+		c->events[n].data = event;
+		c->events[n].ix = i;
+		c->events[n].offset = offset;
+		n++;
+
+next_event:
+		event = (void *)event + ev_len;
+	}
+
+	if (i != event_entry_count)
+		warnx("event buffer ended before listed # of events were parsed (got %zu, wanted %u)", i, event_entry_count);
+
+	c->event_count = n;
+	return 0;
+}
+
+size_t catalog_name_trim(const char *s, size_t len)
+{
+	while (len && s[len - 1] == '\0')
+		len--;
+	return len;
+}
+
+static int name_cmp(const char *a, size_t al, const char *b, size_t bl)
+{
+	al = catalog_name_trim(a, al);
+	bl = catalog_name_trim(b, bl);
+	int r = memcmp(a, b, min(al, bl));
+	if (r)
+		return r;
+	return (al > bl) - (al < bl);
+}
+
+static int event_name_cmp(const void *a_, const void *b_)
+{
+	struct catalog_event *a = *(struct catalog_event **)a_;
+	struct catalog_event *b = *(struct catalog_event **)b_;
+	size_t al, bl;
+	const char *an = event_name(a->data, &al);
+	const char *bn = event_name(b->data, &bl);
+	return name_cmp(an, al, bn, bl);
+}
+
+static int index_events(struct catalog *c)
+{
+	size_t i;
+
+	c->events_by_name = malloc(sizeof(*c->events_by_name) * c->event_count);
+	if (!c->events_by_name && c->event_count) {
+		warnx("alloc failure event name index");
+		return -1;
+	}
+
+	for (i = 0; i < c->event_count; i++)
+		c->events_by_name[i] = &c->events[i];
+	qsort(c->events_by_name, c->event_count, sizeof(*c->events_by_name), event_name_cmp);
+	return 0;
+}
+
+struct catalog_event *catalog_find_event(struct catalog *c, const char *name, size_t name_len)
+{
+	size_t lo = 0, hi = c->event_count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2, l;
+		const char *n = event_name(c->events_by_name[mid]->data, &l);
+		int r = name_cmp(name, name_len, n, l);
+		if (!r)
+			return c->events_by_name[mid];
+		if (r < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+struct hv_24x7_formula_data *catalog_find_formula(struct catalog *c,
+		const char *name, size_t name_len)
+{
+	size_t i, l;
+	for (i = 0; i < c->formula_count; i++) {
+		const char *n = formula_name(c->formulas[i], &l);
+		if (!name_cmp(name, name_len, n, l))
+			return c->formulas[i];
+	}
+	return NULL;
+}
+
+int catalog_decode(struct catalog *c, void *data, size_t len)
+{
+	memset(c, 0, sizeof(*c));
+	c->data = data;
+	c->len = len;
+
+	if (len < CATALOG_PAGE_SIZE) {
+		warnx("could not read page 0, got %zu bytes", len);
+		return -1;
+	}
+
+	struct hv_24x7_catalog_page_0 *p0 = c->page_0 = data;
+
+	pr_debug(1, "magic  = %.*s", (int)sizeof(p0->magic), (char *)&p0->magic);
+	pr_debug(1, "length = %zu pages", (size_t)be_to_cpu(p0->length));
+	pr_debug(1, "build_time_stamp = %.*s", (int)sizeof(p0->build_time_stamp), p0->build_time_stamp);
+	pr_debug(1, "version = %"PRIu64, (uint64_t)be_to_cpu(p0->version));
+
+	pr_debug(1, "schema: offs=%u len=%u count=%u",
+			(unsigned)be_to_cpu(p0->schema_data_offs),
+			(unsigned)be_to_cpu(p0->schema_data_len),
+			(unsigned)be_to_cpu(p0->schema_entry_count));
+	pr_debug(1, "event: offs=%u len=%u count=%u",
+			(unsigned)be_to_cpu(p0->event_data_offs),
+			(unsigned)be_to_cpu(p0->event_data_len),
+			(unsigned)be_to_cpu(p0->event_entry_count));
+	pr_debug(1, "group: offs=%u len=%u count=%u",
+			(unsigned)be_to_cpu(p0->group_data_offs),
+			(unsigned)be_to_cpu(p0->group_data_len),
+			(unsigned)be_to_cpu(p0->group_entry_count));
+	pr_debug(1, "formula: offs=%u len=%u count=%u",
+			(unsigned)be_to_cpu(p0->formula_data_offs),
+			(unsigned)be_to_cpu(p0->formula_data_len),
+			(unsigned)be_to_cpu(p0->formula_entry_count));
+
+	if (decode_schemas(c) || decode_groups(c) || decode_events(c) ||
+			index_events(c)) {
+		catalog_free(c);
+		return -1;
+	}
+
+	/* Nothing else depends on the formulas, so a bad section only loses them */
+	if (decode_formulas(c))
+		warnx("skipping the formulas");
+
+	return 0;
+}
+
+int catalog_read(const char *file, void **data, size_t *len)
+{
+	FILE *f = fopen(file, "rb");
+	if (!f) {
+		warn("could not open %s", file);
+		return -1;
+	}
+
+	size_t bytes = CATALOG_PAGE_SIZE;
+	void *buf = malloc(bytes);
+	if (!buf) {
+		warnx("alloc failure %zu", bytes);
+		goto out_close;
+	}
+
+	size_t r = fread(buf, 1, CATALOG_PAGE_SIZE, f);
+	if (r != CATALOG_PAGE_SIZE) {
+		warnx("could not read page 0 of %s, got %zu bytes", file, r);
+		goto out_free;
+	}
+
+	struct hv_24x7_catalog_page_0 *p0 = buf;
+	size_t pages = be_to_cpu(p0->length);
+	if (pages > 1) {
+		bytes = pages * CATALOG_PAGE_SIZE;
+		void *n = realloc(buf, bytes);
+		if (!n) {
+			warnx("alloc failure %zu", bytes);
+			goto out_free;
+		}
+		buf = n;
+
+		r = fread(buf + CATALOG_PAGE_SIZE, 1, bytes - CATALOG_PAGE_SIZE, f);
+		if (r != bytes - CATALOG_PAGE_SIZE) {
+			warnx("%s: catalog truncated, got %zu of %zu pages",
+					file, 1 + r / CATALOG_PAGE_SIZE, pages);
+			bytes = CATALOG_PAGE_SIZE + r;
+		}
+	}
+
+	fclose(f);
+	*data = buf;
+	*len = bytes;
+	return 0;
+
+out_free:
+	free(buf);
+out_close:
+	fclose(f);
+	return -1;
+}
+
+int catalog_load(struct catalog *c, const char *file)
+{
+	void *data;
+	size_t len;
+	if (catalog_read(file, &data, &len))
+		return -1;
+
+	if (catalog_decode(c, data, len)) {
+		free(data);
+		return -1;
+	}
+
+	c->owns_data = true;
+	return 0;
+}
+
+void catalog_free(struct catalog *c)
+{
+	free(c->schemas);
+	free(c->groups);
+	free(c->events);
+	free(c->events_by_name);
+	free(c->formulas);
+	if (c->owns_data)
+		free(c->data);
+	memset(c, 0, sizeof(*c));
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef CATALOG_H_
+#define CATALOG_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#define __packed __attribute__((__packed__))
+#include "hv-24x7-catalog.h"
+
+#define CATALOG_PAGE_SIZE 4096
+
+/* 2 mappings:
+ * - # to name
+ * - name to #
+ */
+enum hv_perf_domains {
+#define DOMAIN(n, v, x) HV_PERF_DOMAIN_##n = v,
+#include "hv-24x7-domains.h"
+#undef DOMAIN
+};
+
+struct catalog_event {
+	struct hv_24x7_event_data *data;
+	/* position in the catalog's event list, including unused entries */
+	size_t ix;
+	/* in bytes, from the start of the event data */
+	size_t offset;
+};
+
+/*
+ * A decoded catalog. All pointers refer into @data, which is owned by the
+ * catalog only when it was filled in by catalog_load().
+ */
+struct catalog {
+	void *data;
+	size_t len;
+	bool owns_data;
+
+	struct hv_24x7_catalog_page_0 *page_0;
+
+	struct hv_24x7_grs **schemas;
+	size_t schema_count;
+
+	struct hv_24x7_group_data **groups;
+	size_t group_count;
+
+	/* only events which have a group record, unused entries are skipped */
+	struct catalog_event *events;
+	size_t event_count;
+
+	/* @events sorted by name, for catalog_find_event() */
+	struct catalog_event **events_by_name;
+
+	struct hv_24x7_formula_data **formulas;
+	size_t formula_count;
+};
+
+bool is_physical_domain(enum hv_perf_domains domain);
+const char *domain_to_index_string(enum hv_perf_domains domain);
+/* NULL for the domain whose alias is just the event name */
+const char *domain_alias_suffix(enum hv_perf_domains domain);
+
+char *event_name(struct hv_24x7_event_data *ev, size_t *len);
+char *event_desc(struct hv_24x7_event_data *ev, size_t *len);
+char *event_long_desc(struct hv_24x7_event_data *ev, size_t *len);
+unsigned event_offset(struct hv_24x7_event_data *ev);
+
+/* Names and strings are '\0' padded: returns @len without the padding */
+size_t catalog_name_trim(const char *s, size_t len);
+
+#define CATALOG_EVENT_DOMAINS_MAX 5
+/* Fills @domains with the domains @ev may be requested in, returns the count */
+size_t event_domains(struct hv_24x7_event_data *ev, unsigned *domains);
+
+char *group_name(struct hv_24x7_group_data *group, size_t *len);
+char *group_desc(struct hv_24x7_group_data *group, size_t *len);
+
+char *formula_name(struct hv_24x7_formula_data *f, size_t *len);
+char *formula_desc(struct hv_24x7_formula_data *f, size_t *len);
+/* the formula itself, see formula-graph.h for the syntax */
+char *formula_text(struct hv_24x7_formula_data *f, size_t *len);
+
+/*
+ * Read an entire catalog (as indicated by the length in page 0) into a newly
+ * allocated buffer. Works on files that do not report their size (sysfs).
+ */
+int catalog_read(const char *file, void **data, size_t *len);
+
+/* Index @data. @data must remain valid until catalog_free() */
+int catalog_decode(struct catalog *c, void *data, size_t len);
+
+/* Returns NULL if no event is named @name */
+struct catalog_event *catalog_find_event(struct catalog *c, const char *name, size_t name_len);
+/* Returns NULL if no formula is named @name */
+struct hv_24x7_formula_data *catalog_find_formula(struct catalog *c,
+		const char *name, size_t name_len);
+
+/* catalog_read() + catalog_decode() */
+int catalog_load(struct catalog *c, const char *file);
+void catalog_free(struct catalog *c);
+
+/* catalog-print.c */
+void catalog_print(struct catalog *c, FILE *o);
+
+#endif
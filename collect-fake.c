@@ -0,0 +1,181 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/*
+ * A stand in for H_GET_24X7_DATA. Group records are laid out as their
+ * schema says, with the timebase of the call and counters that only ever
+ * go up, so results decode just like real ones.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+#include <ccan/endian/endian.h>
+
+#include <penny/penny.h>
+
+#include "collect.h"
+
+struct fake_record {
+	unsigned group_domain;
+	unsigned offset, len;
+	/* -1 if the schema has none */
+	int timebase_offset;
+};
+
+struct collect_fake {
+	struct fake_record *records;
+	size_t record_count;
+	unsigned delay_us;
+};
+
+static int fake_record_cmp(const void *a_, const void *b_)
+{
+	const struct fake_record *a = a_, *b = b_;
+	if (a->group_domain != b->group_domain)
+		return a->group_domain < b->group_domain ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return a->len < b->len ? -1 : a->len > b->len;
+}
+
+struct collect_fake *collect_fake_new(struct catalog *c, unsigned delay_us)
+{
+	struct collect_fake *f = calloc(1, sizeof(*f));
+	size_t i, j;
+
+	if (!f)
+		err(1, "alloc failure");
+	f->delay_us = delay_us;
+	f->records = calloc(c->group_count, sizeof(*f->records));
+	if (!f->records && c->group_count)
+		err(1, "alloc failure");
+
+	for (i = 0; i < c->group_count; i++) {
+		struct hv_24x7_group_data *g = c->groups[i];
+		struct fake_record *r = &f->records[f->record_count++];
+
+		r->group_domain = g->domain;
+		r->offset = be_to_cpu(g->event_group_record_offs);
+		r->len = be_to_cpu(g->event_group_record_len);
+		r->timebase_offset = -1;
+		if (g->group_schema_ix >= c->schema_count)
+			continue;
+
+		struct hv_24x7_grs *s = c->schemas[g->group_schema_ix];
+		struct hv_24x7_grs_field *fe = (void *)s->field_entrys;
+		for (j = 0; j < be_to_cpu(s->field_entry_count); j++)
+			if (be_to_cpu(fe[j].field_enum) == GRS_TIMEBASE_UPDATE &&
+					be_to_cpu(fe[j].offs) + 8u <= r->len)
+				r->timebase_offset = be_to_cpu(fe[j].offs);
+	}
+
+	qsort(f->records, f->record_count, sizeof(*f->records), fake_record_cmp);
+	return f;
+}
+
+void collect_fake_free(struct collect_fake *f)
+{
+	free(f->records);
+	free(f);
+}
+
+static int fake_timebase_offset(struct collect_fake *f, unsigned domain,
+		unsigned offset, unsigned len)
+{
+	struct fake_record key = {
+		.group_domain = domain == HV_PERF_DOMAIN_PHYSICAL_CHIP ?
+			HV_PERF_DOMAIN_PHYSICAL_CHIP : HV_PERF_DOMAIN_PHYSICAL_CORE,
+		.offset = offset,
+		.len = len,
+	};
+	struct fake_record *r = bsearch(&key, f->records, f->record_count,
+			sizeof(*f->records), fake_record_cmp);
+	return r ? r->timebase_offset : -1;
+}
+
+int collect_fake_get_data(void *arg, const void *request, size_t request_len,
+		void *result, size_t result_len)
+{
+	struct collect_fake *f = arg;
+	const struct hv_24x7_request_buffer *rb = request;
+	struct hv_24x7_data_result_buffer *res = result;
+	unsigned char *p, *end = (unsigned char *)result + result_len;
+	struct timespec ts;
+	size_t i;
+
+	if (request_len < sizeof(*rb) ||
+			request_len < sizeof(*rb) + rb->num_requests * sizeof(rb->requests[0]) ||
+			result_len < sizeof(*res)) {
+		warnx("fake: buffers too short");
+		return -1;
+	}
+
+	if (f->delay_us)
+		nanosleep(&(struct timespec){ .tv_sec = f->delay_us / 1000000,
+				.tv_nsec = (f->delay_us % 1000000) * 1000 }, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	/* the timebase ticks at 512MHz */
+	uint64_t timebase = ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec) * 64 / 125;
+
+	memset(res, 0, sizeof(*res));
+	res->interface_version = rb->interface_version;
+	res->num_results = rb->num_requests;
+
+	p = (unsigned char *)res->results;
+	for (i = 0; i < rb->num_requests; i++) {
+		const struct hv_24x7_request *req = &rb->requests[i];
+		struct hv_24x7_result *r = (void *)p;
+		unsigned data_size = be_to_cpu(req->data_size);
+		unsigned data_offset = be_to_cpu(req->data_offset);
+		unsigned first = be_to_cpu(req->starting_ix), last = be_to_cpu(req->max_ix), ix;
+		size_t element = sizeof(struct hv_24x7_result_element) + data_size;
+		int tb_offset = fake_timebase_offset(f, req->performance_domain,
+				data_offset, data_size);
+
+		if (last < first || (size_t)(end - p) < sizeof(*r) ||
+				(size_t)(end - p - sizeof(*r)) / element < last - first + 1u) {
+			warnx("fake: result buffer too small for request %zu", i);
+			return -1;
+		}
+
+		memset(r, 0, sizeof(*r));
+		r->result_ix = i;
+		r->results_complete = 1;
+		r->num_elements_returned = cpu_to_be16(last - first + 1);
+		r->result_element_data_size = req->data_size;
+		p += sizeof(*r);
+
+		for (ix = first; ix <= last; ix++, p += element) {
+			struct hv_24x7_result_element *e = (void *)p;
+			unsigned k;
+
+			e->lpar_ix = req->starting_lpar_ix;
+			e->domain_ix = cpu_to_be16(ix);
+			e->lpar_cfg_instance_id = cpu_to_be32(0xffffffff);
+
+			/* each counter counts at its own (fixed) fraction of the timebase */
+			for (k = 0; k + 8 <= data_size; k += 8) {
+				uint64_t v = (int)k == tb_offset ? timebase :
+					timebase / 16 * ((data_offset / 8 + k / 8 + ix) % 13 + 1);
+				v = cpu_to_be64(v);
+				memcpy(e->element_data + k, &v, sizeof(v));
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,450 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/* pthread_setaffinity_np() */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+#include <ccan/endian/endian.h>
+
+#include <penny/penny.h>
+#include <penny/math.h>
+
+#include "collect.h"
+
+struct collect_batch {
+	unsigned char *request;
+	size_t request_len;
+	size_t result_len;
+	struct hv_decoder *decoder;
+	/* worker of the chip the batch reads */
+	unsigned home;
+};
+
+/* single producer (the worker), single consumer (collect_interval()) */
+struct sample_ring {
+	struct hv_sample *slots;
+	size_t mask;
+	size_t head __attribute__((aligned(64)));
+	size_t tail __attribute__((aligned(64)));
+	/* producer's last look at @head */
+	size_t head_cache;
+};
+
+struct collect_worker {
+	struct collect_engine *e;
+	pthread_t thread;
+	unsigned id;
+
+	/* result buffer for every call this worker makes */
+	unsigned char *result;
+
+	/* home batches, taken in order by whoever gets to them first */
+	size_t *queue;
+	size_t queue_len;
+	size_t next __attribute__((aligned(64)));
+
+	/* per interval, only written by the worker */
+	size_t stolen, errors;
+
+	struct sample_ring ring;
+} __attribute__((aligned(64)));
+
+struct collect_engine {
+	struct catalog *c;
+	struct collect_backend backend;
+	bool pin;
+
+	struct collect_batch *batches;
+	size_t batch_count, batch_alloc;
+
+	struct collect_worker *workers;
+	unsigned worker_count;
+
+	pthread_barrier_t start, end;
+	bool stop;
+	size_t done;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int ring_push(void *arg, const struct hv_sample *s)
+{
+	struct collect_worker *w = arg;
+	struct sample_ring *r = &w->ring;
+	size_t tail = r->tail;
+
+	while (tail - r->head_cache > r->mask) {
+		r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if (tail - r->head_cache > r->mask)
+			sched_yield();
+	}
+
+	r->slots[tail & r->mask] = *s;
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* Returns the number of samples taken out of the rings */
+static size_t rings_drain(struct collect_engine *e, hv_sample_fn fn, void *arg, int *ret)
+{
+	size_t n = 0;
+	unsigned i;
+
+	for (i = 0; i < e->worker_count; i++) {
+		struct sample_ring *r = &e->workers[i].ring;
+		size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		size_t head = r->head;
+
+		for (; head != tail; head++, n++)
+			if (!*ret)
+				*ret = fn(arg, &r->slots[head & r->mask]);
+		__atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+	}
+
+	return n;
+}
+
+static void batch_run(struct collect_worker *w, struct collect_batch *b)
+{
+	struct collect_engine *e = w->e;
+	uint64_t ts = now_ns();
+
+	if (e->backend.get_data(e->backend.arg, b->request, b->request_len,
+				w->result, b->result_len) ||
+			hv_decode(b->decoder, ts, b->request, b->request_len,
+				w->result, b->result_len, ring_push, w))
+		w->errors++;
+
+	__atomic_fetch_add(&e->done, 1, __ATOMIC_RELEASE);
+}
+
+static struct collect_batch *batch_take(struct collect_engine *e, struct collect_worker *from)
+{
+	size_t i = __atomic_fetch_add(&from->next, 1, __ATOMIC_RELAXED);
+	if (i >= from->queue_len)
+		return NULL;
+	return &e->batches[from->queue[i]];
+}
+
+static void *worker_thread(void *arg)
+{
+	struct collect_worker *w = arg;
+	struct collect_engine *e = w->e;
+	struct collect_batch *b;
+	unsigned k;
+
+	if (e->pin) {
+		cpu_set_t set;
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		CPU_ZERO(&set);
+		CPU_SET(w->id % (cpus > 0 ? cpus : 1), &set);
+		int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (r)
+			pr_debug(1, "could not pin worker %u: %s", w->id, strerror(r));
+	}
+
+	for (;;) {
+		pthread_barrier_wait(&e->start);
+		if (__atomic_load_n(&e->stop, __ATOMIC_ACQUIRE))
+			break;
+
+		while ((b = batch_take(e, w)))
+			batch_run(w, b);
+
+		for (k = 1; k < e->worker_count; k++) {
+			struct collect_worker *victim = &e->workers[(w->id + k) % e->worker_count];
+			while ((b = batch_take(e, victim))) {
+				batch_run(w, b);
+				w->stolen++;
+			}
+		}
+
+		pthread_barrier_wait(&e->end);
+	}
+
+	return NULL;
+}
+
+static struct collect_batch *batch_new(struct collect_engine *e, unsigned home)
+{
+	if (e->batch_count == e->batch_alloc) {
+		e->batch_alloc = e->batch_alloc ? e->batch_alloc * 2 : 64;
+		e->batches = realloc(e->batches, sizeof(*e->batches) * e->batch_alloc);
+		if (!e->batches)
+			err(1, "alloc failure");
+	}
+
+	struct collect_batch *b = &e->batches[e->batch_count++];
+	memset(b, 0, sizeof(*b));
+	b->request_len = sizeof(struct hv_24x7_request_buffer);
+	b->result_len = sizeof(struct hv_24x7_data_result_buffer);
+	b->home = home;
+	return b;
+}
+
+static void batch_add(struct collect_batch *b, unsigned domain,
+		struct hv_24x7_group_data *g, unsigned first, unsigned last)
+{
+	struct hv_24x7_request_buffer *rb;
+	size_t n = b->request ? ((struct hv_24x7_request_buffer *)b->request)->num_requests : 0;
+
+	b->request = realloc(b->request, b->request_len + sizeof(rb->requests[0]));
+	if (!b->request)
+		err(1, "alloc failure");
+	if (!n)
+		memset(b->request, 0, b->request_len);
+
+	rb = (void *)b->request;
+	rb->interface_version = HV_24X7_IF_VERSION_V1;
+	rb->num_requests = n + 1;
+	rb->requests[n] = (struct hv_24x7_request) {
+		.performance_domain = domain,
+		.data_size = g->event_group_record_len,
+		.data_offset = cpu_to_be32(be_to_cpu(g->event_group_record_offs)),
+		.starting_lpar_ix = cpu_to_be16(0xffff),
+		.max_num_lpars = cpu_to_be16(1),
+		.starting_ix = cpu_to_be16(first),
+		.max_ix = cpu_to_be16(last),
+	};
+
+	b->request_len += sizeof(rb->requests[0]);
+	b->result_len += sizeof(struct hv_24x7_result) + (size_t)(last - first + 1) *
+		(sizeof(struct hv_24x7_result_element) + be_to_cpu(g->event_group_record_len));
+}
+
+/*
+ * Split reading every group of @domain for indexes @first to @last into
+ * batches whose results fit in @result_max.
+ */
+static void batches_build(struct collect_engine *e, unsigned domain,
+		unsigned first, unsigned last, unsigned home, size_t result_max)
+{
+	unsigned group_domain = domain == HV_PERF_DOMAIN_PHYSICAL_CHIP ?
+		HV_PERF_DOMAIN_PHYSICAL_CHIP : HV_PERF_DOMAIN_PHYSICAL_CORE;
+	struct collect_batch *b = NULL;
+	size_t i;
+
+	for (i = 0; i < e->c->group_count; i++) {
+		struct hv_24x7_group_data *g = e->c->groups[i];
+		size_t len = be_to_cpu(g->event_group_record_len);
+		if (g->domain != group_domain || !len || !IS_ALIGNED(len, 8))
+			continue;
+
+		size_t element = sizeof(struct hv_24x7_result_element) + len;
+		size_t fixed = sizeof(struct hv_24x7_data_result_buffer) + sizeof(struct hv_24x7_result);
+		if (fixed + element > result_max) {
+			pr_debug(1, "group %zu does not fit in a %zu byte result", i, result_max);
+			continue;
+		}
+		size_t per_request = (result_max - fixed) / element;
+
+		unsigned ix = first;
+		while (ix <= last) {
+			unsigned end = last - ix + 1 > per_request ? ix + per_request - 1 : last;
+			size_t need = sizeof(struct hv_24x7_result) + (end - ix + 1) * element;
+
+			/* num_requests is a byte */
+			if (!b || b->result_len + need > result_max ||
+					((struct hv_24x7_request_buffer *)b->request)->num_requests == UINT8_MAX)
+				b = batch_new(e, home);
+
+			batch_add(b, domain, g, ix, end);
+			ix = end + 1;
+		}
+	}
+}
+
+struct collect_engine *collect_engine_new(struct catalog *c,
+		const struct collect_config *cfg, const struct collect_backend *backend)
+{
+	struct collect_engine *e = calloc(1, sizeof(*e));
+	unsigned workers = cfg->workers ? cfg->workers : 1;
+	unsigned chips = cfg->chips ? cfg->chips : 1;
+	unsigned cores = cfg->cores_per_chip ? cfg->cores_per_chip : 1;
+	size_t ring_size, i;
+	unsigned d, chip;
+
+	if (!e)
+		err(1, "alloc failure");
+
+	e->c = c;
+	e->backend = *backend;
+	e->pin = cfg->pin;
+
+	for (d = 0; d < cfg->domain_count; d++) {
+		unsigned domain = cfg->domains[d];
+		switch (domain) {
+		case HV_PERF_DOMAIN_PHYSICAL_CHIP:
+			for (chip = 0; chip < chips; chip++)
+				batches_build(e, domain, chip, chip, chip % workers, cfg->result_max);
+			break;
+		case HV_PERF_DOMAIN_PHYSICAL_CORE:
+			for (chip = 0; chip < chips; chip++)
+				batches_build(e, domain, chip * cores, chip * cores + cores - 1,
+						chip % workers, cfg->result_max);
+			break;
+		case HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_HOME_CORE:
+		case HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_HOME_CHIP:
+		case HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_HOME_NODE:
+		case HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_REMOTE_NODE: {
+			/* where a vcpu runs isn't known, spread them like cores */
+			unsigned ix;
+			for (ix = 0, chip = 0; ix < cfg->vcpus; ix += cores, chip++)
+				batches_build(e, domain, ix, min(ix + cores, cfg->vcpus) - 1,
+						chip % workers, cfg->result_max);
+			break;
+		}
+		default:
+			warnx("unknown domain %u", domain);
+			goto err;
+		}
+	}
+
+	if (!e->batch_count) {
+		warnx("nothing to collect: no groups fit the requested domains");
+		goto err;
+	}
+
+	for (i = 0; i < e->batch_count; i++)
+		e->batches[i].decoder = hv_decoder_new(c, cfg->timebase_hz);
+
+	if (posix_memalign((void **)&e->workers, 64, sizeof(*e->workers) * workers))
+		err(1, "alloc failure");
+	memset(e->workers, 0, sizeof(*e->workers) * workers);
+	e->worker_count = workers;
+
+	for (ring_size = 1; ring_size < cfg->ring_size; ring_size *= 2)
+		;
+
+	for (d = 0; d < workers; d++) {
+		struct collect_worker *w = &e->workers[d];
+		w->e = e;
+		w->id = d;
+		w->result = malloc(cfg->result_max);
+		w->queue = malloc(sizeof(*w->queue) * e->batch_count);
+		w->ring.slots = malloc(sizeof(*w->ring.slots) * ring_size);
+		w->ring.mask = ring_size - 1;
+		if (!w->result || !w->queue || !w->ring.slots)
+			err(1, "alloc failure");
+	}
+
+	for (i = 0; i < e->batch_count; i++) {
+		struct collect_worker *w = &e->workers[e->batches[i].home];
+		w->queue[w->queue_len++] = i;
+	}
+
+	pthread_barrier_init(&e->start, NULL, workers + 1);
+	pthread_barrier_init(&e->end, NULL, workers + 1);
+
+	for (d = 0; d < workers; d++) {
+		int r = pthread_create(&e->workers[d].thread, NULL, worker_thread, &e->workers[d]);
+		if (r) {
+			errno = r;
+			err(1, "could not create worker thread");
+		}
+	}
+
+	pr_debug(1, "%zu batches over %u workers", e->batch_count, workers);
+	return e;
+
+err:
+	for (i = 0; i < e->batch_count; i++)
+		free(e->batches[i].request);
+	free(e->batches);
+	free(e);
+	return NULL;
+}
+
+void collect_engine_free(struct collect_engine *e)
+{
+	size_t i;
+
+	__atomic_store_n(&e->stop, true, __ATOMIC_RELEASE);
+	pthread_barrier_wait(&e->start);
+	for (i = 0; i < e->worker_count; i++) {
+		struct collect_worker *w = &e->workers[i];
+		pthread_join(w->thread, NULL);
+		free(w->result);
+		free(w->queue);
+		free(w->ring.slots);
+	}
+
+	pthread_barrier_destroy(&e->start);
+	pthread_barrier_destroy(&e->end);
+
+	for (i = 0; i < e->batch_count; i++) {
+		hv_decoder_free(e->batches[i].decoder);
+		free(e->batches[i].request);
+	}
+	free(e->batches);
+	free(e->workers);
+	free(e);
+}
+
+size_t collect_engine_batch_count(struct collect_engine *e)
+{
+	return e->batch_count;
+}
+
+int collect_interval(struct collect_engine *e, hv_sample_fn fn, void *arg,
+		struct collect_stats *st)
+{
+	int ret = 0;
+	unsigned i;
+
+	memset(st, 0, sizeof(*st));
+	e->done = 0;
+	for (i = 0; i < e->worker_count; i++) {
+		struct collect_worker *w = &e->workers[i];
+		w->next = 0;
+		w->stolen = 0;
+		w->errors = 0;
+	}
+
+	pthread_barrier_wait(&e->start);
+
+	for (;;) {
+		/* samples are pushed before their batch is counted as done */
+		size_t done = __atomic_load_n(&e->done, __ATOMIC_ACQUIRE);
+		size_t n = rings_drain(e, fn, arg, &ret);
+		st->samples += n;
+		if (done == e->batch_count && !n)
+			break;
+		if (!n)
+			sched_yield();
+	}
+
+	pthread_barrier_wait(&e->end);
+
+	st->batches = e->batch_count;
+	for (i = 0; i < e->worker_count; i++) {
+		st->stolen += e->workers[i].stolen;
+		st->errors += e->workers[i].errors;
+	}
+
+	return ret;
+}
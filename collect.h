@@ -0,0 +1,95 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef COLLECT_H_
+#define COLLECT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "catalog.h"
+#include "hv-decode.h"
+
+/*
+ * Parallel collection: every group record of the catalog, in every
+ * requested domain and for every chip, core or vcpu, read once per interval.
+ *
+ * The reads are split into batches (one H_GET_24X7_DATA call each, sized
+ * to fit @result_max) covering a range of indexes of one domain. Batches
+ * belong to the worker of the chip they are for, so a worker keeps reading
+ * the same chips; a worker that runs out of batches takes them from the
+ * others. Each batch keeps its own decoder state, so it can be run by any
+ * worker.
+ *
+ * Workers pass decoded samples back through one ring buffer each, which
+ * collect_interval() drains on the calling thread.
+ */
+
+struct collect_backend {
+	/*
+	 * Perform the H_GET_24X7_DATA call for @request, filling @result.
+	 * Called concurrently from every worker.
+	 */
+	int (*get_data)(void *arg, const void *request, size_t request_len,
+			void *result, size_t result_len);
+	void *arg;
+};
+
+struct collect_config {
+	unsigned workers;
+	/* pin worker N to cpu N (mod the number of cpus) */
+	bool pin;
+
+	/* size of each call's result buffer, the kernel uses a page */
+	size_t result_max;
+	/* samples, per worker. Rounded up to a power of 2 */
+	size_t ring_size;
+
+	unsigned chips;
+	unsigned cores_per_chip;
+	unsigned vcpus;
+
+	const unsigned *domains;
+	size_t domain_count;
+
+	uint64_t timebase_hz;
+};
+
+struct collect_stats {
+	size_t batches;
+	/* batches run by a worker other than their own */
+	size_t stolen;
+	/* failed calls or undecodable results */
+	size_t errors;
+	uint64_t samples;
+};
+
+struct collect_engine;
+
+struct collect_engine *collect_engine_new(struct catalog *c,
+		const struct collect_config *cfg, const struct collect_backend *b);
+void collect_engine_free(struct collect_engine *e);
+
+size_t collect_engine_batch_count(struct collect_engine *e);
+
+/*
+ * Run every batch once. @fn is called on this thread for every sample,
+ * while the workers are still collecting.
+ */
+int collect_interval(struct collect_engine *e, hv_sample_fn fn, void *arg,
+		struct collect_stats *st);
+
+/* collect-fake.c: results made up from the catalog, for testing without hardware */
+struct collect_fake;
+struct collect_fake *collect_fake_new(struct catalog *c, unsigned delay_us);
+void collect_fake_free(struct collect_fake *f);
+int collect_fake_get_data(void *arg, const void *request, size_t request_len,
+		void *result, size_t result_len);
+
+#endif
@@ -0,0 +1,201 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/*
+ * Drive the parallel collection engine against the fake backend, to see
+ * how many chips/cores/vcpus worth of groups fit in an interval.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/err/err.h>
+
+#include "catalog.h"
+#include "collect.h"
+
+static void _usage(const char *p, int e)
+{
+	FILE *o = stderr;
+	fprintf(o,
+"usage: %s [options] <catalog>\n"
+"\n"
+"Collect every group of the catalog, for every chip, core or vcpu, once per\n"
+"interval, from a fake hypervisor.\n"
+"\n"
+"  -d domain  collect in this domain, may be repeated (default: 2, physical core)\n"
+"  -c chips   (default: 4)\n"
+"  -k cores   per chip (default: 8)\n"
+"  -v vcpus   (default: 64)\n"
+"  -w workers (default: # of online cpus)\n"
+"  -P         don't pin workers to cpus\n"
+"  -r bytes   result buffer size (default: 4096)\n"
+"  -l usec    latency of each fake call (default: 0)\n"
+"  -i ms      interval (default: 0, back to back)\n"
+"  -n count   intervals to run (default: 10)\n"
+"  -p         print every sample\n", p);
+	exit(e);
+}
+
+#define _PRGM_NAME "hv-collect"
+#define PRGM_NAME  (argc?argv[0]:_PRGM_NAME)
+#define usage(argc, argv, e) _usage(PRGM_NAME, e)
+#define U(e) usage(argc, argv, e)
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int print_sample(void *arg, const struct hv_sample *s)
+{
+	size_t nl;
+	const char *name = event_name(s->event->data, &nl);
+	(void)arg;
+	printf("%.*s domain=0x%x,ix=%u value=%"PRIu64" delta=%"PRIu64" rate=%.0f\n",
+			(int)nl, name, s->domain, s->domain_ix, s->value, s->delta, s->rate);
+	return 0;
+}
+
+static int count_sample(void *arg, const struct hv_sample *s)
+{
+	uint64_t *first = arg;
+	if (!s->delta)
+		(*first)++;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned domains[HV_PERF_DOMAIN_VIRTUAL_PROCESSOR_REMOTE_NODE];
+	struct collect_config cfg = {
+		.workers = sysconf(_SC_NPROCESSORS_ONLN),
+		.pin = true,
+		.result_max = 4096,
+		.ring_size = 1 << 16,
+		.chips = 4,
+		.cores_per_chip = 8,
+		.vcpus = 64,
+		.domains = domains,
+		.timebase_hz = HV_TIMEBASE_HZ_DEFAULT,
+	};
+	unsigned delay_us = 0, interval_ms = 0, i;
+	unsigned long intervals = 10, n;
+	bool print = false;
+	int opt;
+
+	err_set_progname(PRGM_NAME);
+
+	while ((opt = getopt(argc, argv, "d:c:k:v:w:Pr:l:i:n:ph")) != -1) {
+		switch (opt) {
+		case 'd':
+			if (cfg.domain_count == ARRAY_SIZE(domains))
+				errx(1, "too many domains");
+			domains[cfg.domain_count++] = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cfg.chips = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			cfg.cores_per_chip = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			cfg.vcpus = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			cfg.workers = strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			cfg.pin = false;
+			break;
+		case 'r':
+			cfg.result_max = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			delay_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			intervals = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			print = true;
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (argc - optind != 1 || !cfg.workers)
+		U(1);
+
+	if (!cfg.domain_count)
+		domains[cfg.domain_count++] = HV_PERF_DOMAIN_PHYSICAL_CORE;
+
+	struct catalog c;
+	if (catalog_load(&c, argv[optind]))
+		return 1;
+
+	struct collect_fake *fake = collect_fake_new(&c, delay_us);
+	struct collect_backend backend = {
+		.get_data = collect_fake_get_data,
+		.arg = fake,
+	};
+
+	struct collect_engine *e = collect_engine_new(&c, &cfg, &backend);
+	if (!e)
+		return 1;
+
+	printf("%zu calls per interval, %u workers\n", collect_engine_batch_count(e), cfg.workers);
+
+	uint64_t start = now_ns(), samples = 0;
+	size_t errors = 0;
+	for (n = 0; n < intervals; n++) {
+		uint64_t t0 = now_ns(), first = 0;
+		struct collect_stats st;
+
+		collect_interval(e, print ? print_sample : count_sample, &first, &st);
+
+		uint64_t t1 = now_ns();
+		printf("interval %lu: %zu calls (%zu stolen), %"PRIu64" samples, %zu errors in %.3f ms\n",
+				n, st.batches, st.stolen, st.samples, st.errors, (t1 - t0) / 1e6);
+		if (!print && n && first)
+			warnx("interval %lu: %"PRIu64" samples without a delta", n, first);
+
+		samples += st.samples;
+		errors += st.errors;
+
+		if (interval_ms && (t1 - t0) / 1000000 < interval_ms) {
+			i = interval_ms - (t1 - t0) / 1000000;
+			nanosleep(&(struct timespec){ .tv_sec = i / 1000,
+					.tv_nsec = (i % 1000) * 1000000L }, NULL);
+		}
+	}
+
+	double secs = (now_ns() - start) / 1e9;
+	printf("%"PRIu64" samples in %.3f s, %.0f samples/s\n", samples, secs, samples / secs);
+
+	collect_engine_free(e);
+	collect_fake_free(fake);
+	catalog_free(&c);
+	return !!errors;
+}
@@ -0,0 +1,402 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/*
+ * Export the events in a catalog as either perf pmu-events style json or a
+ * C header containing a sorted event table and a prebuilt hash table for
+ * name lookups. Output only depends on the catalog (and the format), so
+ * builds using it are reproducible.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/err/err.h>
+
+#include <penny/penny.h>
+
+#include "catalog.h"
+#include "pmu-format.h"
+
+/* Used when no format directory is given, matches the kernel's hv_24x7 */
+static const struct {
+	const char *name, *spec;
+} hv_24x7_format[] = {
+	{ "domain", "config:0-3" },
+	{ "starting_index", "config:16-31" },
+	{ "offset", "config:32-63" },
+	{ "lpar", "config1:0-15" },
+};
+
+static const char *const export_fields[] = {
+	"domain",
+	"offset",
+};
+
+struct export_event {
+	char *name; /* including the domain suffix */
+	const char *desc, *long_desc;
+	size_t desc_len, long_desc_len;
+	unsigned domain;
+	unsigned offset;
+	struct pmu_config config;
+};
+
+static int export_event_cmp(const void *a_, const void *b_)
+{
+	const struct export_event *a = a_, *b = b_;
+	return strcmp(a->name, b->name);
+}
+
+static struct export_event *collect_events(struct catalog *c, const struct pmu_format *f, size_t *count)
+{
+	struct export_event *evs = malloc(sizeof(*evs) * c->event_count * CATALOG_EVENT_DOMAINS_MAX);
+	uint64_t *args = malloc(sizeof(*args) * c->event_count * CATALOG_EVENT_DOMAINS_MAX * ARRAY_SIZE(export_fields));
+	struct pmu_config *configs = malloc(sizeof(*configs) * c->event_count * CATALOG_EVENT_DOMAINS_MAX);
+	struct pmu_encoder e;
+	size_t i, j, n = 0;
+
+	if ((!evs || !args || !configs) && c->event_count)
+		err(1, "alloc failure");
+
+	if (pmu_encoder_compile(&e, f, export_fields, ARRAY_SIZE(export_fields)))
+		exit(1);
+
+	for (i = 0; i < c->event_count; i++) {
+		struct hv_24x7_event_data *ev = c->events[i].data;
+		unsigned domains[CATALOG_EVENT_DOMAINS_MAX];
+		size_t domain_count = event_domains(ev, domains);
+		size_t nl;
+		const char *name = event_name(ev, &nl);
+
+		for (j = 0; j < domain_count; j++) {
+			struct export_event *x = &evs[n];
+			const char *suffix = domain_alias_suffix(domains[j]);
+			size_t l = nl + (suffix ? 2 + strlen(suffix) : 0) + 1;
+
+			x->name = malloc(l);
+			if (!x->name)
+				err(1, "alloc failure");
+			snprintf(x->name, l, "%.*s%s%s", (int)nl, name,
+					suffix ? "__" : "", suffix ? suffix : "");
+
+			x->desc = event_desc(ev, &x->desc_len);
+			x->desc_len = catalog_name_trim(x->desc, x->desc_len);
+			x->long_desc = event_long_desc(ev, &x->long_desc_len);
+			x->long_desc_len = catalog_name_trim(x->long_desc, x->long_desc_len);
+			x->domain = domains[j];
+			x->offset = event_offset(ev);
+
+			args[n * e.arg_count + 0] = x->domain;
+			args[n * e.arg_count + 1] = x->offset;
+			n++;
+		}
+	}
+
+	if (pmu_encode_bulk(&e, args, n, configs))
+		warnx("some events don't fit the format");
+	for (i = 0; i < n; i++)
+		evs[i].config = configs[i];
+
+	qsort(evs, n, sizeof(*evs), export_event_cmp);
+
+	pmu_encoder_free(&e);
+	free(configs);
+	free(args);
+	*count = n;
+	return evs;
+}
+
+static void json_string(FILE *o, const char *s, size_t len)
+{
+	size_t i;
+	fputc('"', o);
+	for (i = 0; i < len; i++) {
+		unsigned char ch = s[i];
+		if (ch == '"' || ch == '\\')
+			fprintf(o, "\\%c", ch);
+		else if (ch == '\n')
+			fputs("\\n", o);
+		else if (ch < 0x20 || ch >= 0x7f)
+			fprintf(o, "\\u%04x", ch);
+		else
+			fputc(ch, o);
+	}
+	fputc('"', o);
+}
+
+static void export_json(FILE *o, const char *unit, struct export_event *evs, size_t n)
+{
+	size_t i;
+
+	fputs("[\n", o);
+	for (i = 0; i < n; i++) {
+		struct export_event *x = &evs[i];
+
+		fputs("    {\n        \"EventName\": ", o);
+		json_string(o, x->name, strlen(x->name));
+		/*
+		 * hv_24x7 has no 'event' field for an EventCode to go in, so
+		 * give the alias' own terms, which jevents passes on as is.
+		 */
+		fprintf(o, ",\n        \"Filter\": \"domain=0x%x,offset=0x%x,starting_index=%s,lpar=%s\"",
+				x->domain, x->offset, domain_to_index_string(x->domain),
+				is_physical_domain(x->domain) ? "0x0" : "sibling_guest_id");
+		fputs(",\n        \"Unit\": ", o);
+		json_string(o, unit, strlen(unit));
+		fputs(",\n        \"BriefDescription\": ", o);
+		json_string(o, x->desc, x->desc_len);
+		fputs(",\n        \"PublicDescription\": ", o);
+		json_string(o, x->long_desc, x->long_desc_len);
+		fprintf(o, "\n    }%s\n", i + 1 < n ? "," : "");
+	}
+	fputs("]\n", o);
+}
+
+static void c_string(FILE *o, const char *s, size_t len)
+{
+	size_t i;
+	fputc('"', o);
+	for (i = 0; i < len; i++) {
+		unsigned char ch = s[i];
+		if (ch == '"' || ch == '\\')
+			fprintf(o, "\\%c", ch);
+		else if (ch == '\n')
+			fputs("\\n", o);
+		else if (ch < 0x20 || ch >= 0x7f)
+			/* octal, so a following digit can't extend the escape */
+			fprintf(o, "\\%03o", ch);
+		else
+			fputc(ch, o);
+	}
+	fputc('"', o);
+}
+
+/*
+ * FNV-1a. The generated header carries an identical copy, keep the two in
+ * sync.
+ */
+static uint32_t name_hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void export_c(FILE *o, const char *prefix, struct catalog *c,
+		struct export_event *evs, size_t n)
+{
+	struct hv_24x7_catalog_page_0 *p0 = c->page_0;
+	size_t i, hash_size = 1;
+	char upper[64];
+
+	for (i = 0; prefix[i] && i < sizeof(upper) - 1; i++)
+		upper[i] = toupper((unsigned char)prefix[i]);
+	upper[i] = '\0';
+
+	/* keep the load factor at or below 1/2 */
+	while (hash_size < n * 2)
+		hash_size <<= 1;
+
+	/* 0 marks an empty slot, others hold the event's index + 1 */
+	uint32_t *hash = calloc(hash_size, sizeof(*hash));
+	if (!hash)
+		err(1, "alloc failure");
+	for (i = 0; i < n; i++) {
+		size_t slot = name_hash(evs[i].name) & (hash_size - 1);
+		while (hash[slot])
+			slot = (slot + 1) & (hash_size - 1);
+		hash[slot] = i + 1;
+	}
+
+	fprintf(o, "/*\n"
+		" * Generated by catalog-export from catalog version %"PRIu64" (%.*s).\n"
+		" * Do not edit.\n"
+		" */\n"
+		"#ifndef %s_EVENTS_H_\n"
+		"#define %s_EVENTS_H_\n"
+		"\n"
+		"#include <stddef.h>\n"
+		"#include <stdint.h>\n"
+		"#include <string.h>\n"
+		"\n"
+		"struct %s_event {\n"
+		"	const char *name;\n"
+		"	const char *desc;\n"
+		"	const char *long_desc;\n"
+		"	/* config with starting_index and lpar left as 0 */\n"
+		"	uint64_t config;\n"
+		"	uint32_t offset;\n"
+		"	uint8_t domain;\n"
+		"};\n"
+		"\n"
+		"#define %s_CATALOG_VERSION %"PRIu64"ULL\n"
+		"#define %s_EVENT_COUNT %zu\n"
+		"#define %s_EVENT_HASH_SIZE %zu\n"
+		"\n"
+		"/* sorted by name */\n"
+		"static const struct %s_event %s_events[%s_EVENT_COUNT] = {\n",
+		(uint64_t)be_to_cpu(p0->version),
+		(int)strnlen((char *)p0->build_time_stamp, sizeof(p0->build_time_stamp)),
+		p0->build_time_stamp,
+		upper, upper, prefix,
+		upper, (uint64_t)be_to_cpu(p0->version),
+		upper, n,
+		upper, hash_size,
+		prefix, prefix, upper);
+
+	for (i = 0; i < n; i++) {
+		struct export_event *x = &evs[i];
+		fputs("	{ ", o);
+		c_string(o, x->name, strlen(x->name));
+		fputs(",\n	  ", o);
+		c_string(o, x->desc, x->desc_len);
+		fputs(",\n	  ", o);
+		c_string(o, x->long_desc, x->long_desc_len);
+		fprintf(o, ",\n	  0x%"PRIx64"ULL, 0x%x, %u },\n",
+				x->config.config[0], x->offset, x->domain);
+	}
+
+	fprintf(o, "};\n"
+		"\n"
+		"/* open addressing (linear probing) on %s_event_name_hash(), index + 1 */\n"
+		"static const uint%d_t %s_event_hash[%s_EVENT_HASH_SIZE] = {",
+		prefix, n < 0xffff ? 16 : 32, prefix, upper);
+
+	for (i = 0; i < hash_size; i++)
+		fprintf(o, "%s%"PRIu32",", i % 16 ? " " : "\n	", hash[i]);
+
+	fprintf(o, "\n};\n"
+		"\n"
+		"static inline uint32_t %s_event_name_hash(const char *s)\n"
+		"{\n"
+		"	uint32_t h = 2166136261u;\n"
+		"	while (*s) {\n"
+		"		h ^= (unsigned char)*s++;\n"
+		"		h *= 16777619u;\n"
+		"	}\n"
+		"	return h;\n"
+		"}\n"
+		"\n"
+		"static inline const struct %s_event *%s_event_find(const char *name)\n"
+		"{\n"
+		"	size_t slot = %s_event_name_hash(name) & (%s_EVENT_HASH_SIZE - 1);\n"
+		"	while (%s_event_hash[slot]) {\n"
+		"		const struct %s_event *ev = &%s_events[%s_event_hash[slot] - 1];\n"
+		"		if (!strcmp(ev->name, name))\n"
+		"			return ev;\n"
+		"		slot = (slot + 1) & (%s_EVENT_HASH_SIZE - 1);\n"
+		"	}\n"
+		"	return NULL;\n"
+		"}\n"
+		"\n"
+		"#endif\n",
+		prefix,
+		prefix, prefix,
+		prefix, upper,
+		prefix,
+		prefix, prefix, prefix,
+		upper);
+
+	free(hash);
+}
+
+static void _usage(const char *p, int e)
+{
+	FILE *o = stderr;
+	fprintf(o,
+"usage: %s [-t json|c] [-n name] [-f pmu sysfs dir] <catalog file>\n"
+"\n"
+"  -t json : pmu-events style json (default)\n"
+"  -t c    : C header with a sorted event table and a lookup hash table\n"
+"  -n name : pmu name (json \"Unit\") and C identifier prefix (default: hv_24x7)\n"
+"  -f dir  : encode the C table's config using dir/format/ instead of the\n"
+"            builtin layout\n", p);
+	exit(e);
+}
+
+#define _PRGM_NAME "catalog-export"
+#define PRGM_NAME  (argc?argv[0]:_PRGM_NAME)
+#define usage(argc, argv, e) _usage(PRGM_NAME, e)
+#define U(e) usage(argc, argv, e)
+
+int main(int argc, char **argv)
+{
+	const char *type = "json", *name = "hv_24x7", *pmu_dir = NULL;
+	struct pmu_format f;
+	struct catalog c;
+	size_t i, n;
+	int opt;
+
+	err_set_progname(PRGM_NAME);
+
+	while ((opt = getopt(argc, argv, "t:n:f:h")) != -1) {
+		switch (opt) {
+		case 't':
+			type = optarg;
+			break;
+		case 'n':
+			name = optarg;
+			break;
+		case 'f':
+			pmu_dir = optarg;
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (argc - optind != 1)
+		U(1);
+	if (strcmp(type, "json") && strcmp(type, "c"))
+		U(1);
+	for (i = 0; name[i]; i++)
+		if (!isalnum((unsigned char)name[i]) && name[i] != '_')
+			errx(1, "name must be a C identifier: %s", name);
+
+	if (pmu_dir) {
+		if (pmu_format_read(&f, pmu_dir))
+			return 1;
+	} else {
+		pmu_format_init(&f);
+		for (i = 0; i < ARRAY_SIZE(hv_24x7_format); i++)
+			if (pmu_format_add(&f, hv_24x7_format[i].name, hv_24x7_format[i].spec,
+						strlen(hv_24x7_format[i].spec)))
+				return 1;
+	}
+
+	if (catalog_load(&c, argv[optind]))
+		return 1;
+
+	struct export_event *evs = collect_events(&c, &f, &n);
+
+	if (!strcmp(type, "json"))
+		export_json(stdout, name, evs, n);
+	else
+		export_c(stdout, name, &c, evs, n);
+
+	for (i = 0; i < n; i++)
+		free(evs[i].name);
+	free(evs);
+	catalog_free(&c);
+	pmu_format_free(&f);
+	return 0;
+}
@@ -0,0 +1,666 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <math.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/err/err.h>
+
+#include "formula-graph.h"
+
+/* deepest stack a formula may build */
+#define FG_STACK_MAX 64
+
+enum fg_op {
+	FG_INPUT,
+	FG_CONST,
+	/* everything from here on has 2 operands */
+	FG_ADD,
+	FG_SUB,
+	FG_MUL,
+	FG_DIV,
+	FG_MOD,
+	FG_REM,
+	FG_POW,
+};
+
+struct fg_node {
+	unsigned op;
+	/* operand nodes, or for FG_INPUT @a is the input */
+	unsigned a, b;
+	double k;
+	/* nodes in the tree this node would be without merging */
+	size_t tree;
+};
+
+struct fg_input {
+	const char *name;
+	size_t len;
+	unsigned node;
+};
+
+enum fg_state {
+	FG_ADDED,
+	FG_COMPILING,
+	FG_COMPILED,
+};
+
+struct fg_formula {
+	char *name, *text;
+	size_t name_len, text_len;
+	enum fg_state state;
+	unsigned node;
+};
+
+struct formula_graph {
+	struct catalog *c;
+	size_t instances;
+
+	struct fg_node *nodes;
+	size_t node_count, node_alloc;
+	/* node_alloc arrays of @instances values, in node order */
+	double *values;
+	/* set on an input when it is set to a new value, and on a node when
+	 * it must be (or has been) recomputed, until the end of the next eval */
+	bool *changed;
+	/* one node worth of values */
+	double *scratch;
+
+	/* node + 1 by (op, operands, constant), 0 if empty */
+	unsigned *cse;
+	size_t cse_size, cse_used;
+
+	struct fg_input *inputs;
+	size_t input_count, input_alloc;
+
+	struct fg_formula *formulas;
+	size_t formula_count, formula_alloc;
+	/* formulas before this have been through formula_graph_compile() */
+	size_t compiled;
+};
+
+static const char *const builtins[] = {
+	"delta-timebase",
+	"delta-cycles",
+	"delta-instructions",
+	"delta-seconds",
+};
+
+static void *grow(void *p, size_t *alloc, size_t need, size_t size)
+{
+	if (need <= *alloc)
+		return p;
+
+	size_t n = *alloc ? *alloc * 2 : 16;
+	while (n < need)
+		n *= 2;
+	p = realloc(p, n * size);
+	if (!p)
+		err(1, "alloc failure");
+	*alloc = n;
+	return p;
+}
+
+static uint64_t double_bits(double d)
+{
+	uint64_t v;
+	memcpy(&v, &d, sizeof(v));
+	return v;
+}
+
+static size_t node_hash(unsigned op, unsigned a, unsigned b, double k)
+{
+	uint64_t h = ((uint64_t)op << 56) ^ ((uint64_t)a << 28) ^ b;
+	h = (h ^ double_bits(k)) * 0x9e3779b97f4a7c15ULL;
+	return h ^ (h >> 29);
+}
+
+static double fg_mod(double x, double y)
+{
+	double r = fmod(x, y);
+	if (r != 0 && (r < 0) != (y < 0))
+		r += y;
+	return r;
+}
+
+static double fg_apply(unsigned op, double x, double y)
+{
+	switch (op) {
+	case FG_ADD:
+		return x + y;
+	case FG_SUB:
+		return x - y;
+	case FG_MUL:
+		return x * y;
+	case FG_DIV:
+		return x / y;
+	case FG_MOD:
+		return fg_mod(x, y);
+	case FG_REM:
+		return fmod(x, y);
+	case FG_POW:
+		return pow(x, y);
+	}
+	return NAN;
+}
+
+struct formula_graph *formula_graph_new(struct catalog *c, size_t instances)
+{
+	struct formula_graph *g = calloc(1, sizeof(*g));
+	if (!g)
+		err(1, "alloc failure");
+
+	g->c = c;
+	g->instances = instances;
+	g->scratch = calloc(instances ? instances : 1, sizeof(*g->scratch));
+	if (!g->scratch)
+		err(1, "alloc failure");
+	return g;
+}
+
+void formula_graph_free(struct formula_graph *g)
+{
+	size_t i;
+	for (i = 0; i < g->formula_count; i++) {
+		free(g->formulas[i].name);
+		free(g->formulas[i].text);
+	}
+	free(g->formulas);
+	free(g->inputs);
+	free(g->cse);
+	free(g->scratch);
+	free(g->changed);
+	free(g->values);
+	free(g->nodes);
+	free(g);
+}
+
+static void cse_insert(struct formula_graph *g, unsigned n)
+{
+	struct fg_node *node = &g->nodes[n];
+	size_t mask = g->cse_size - 1;
+	size_t i = node_hash(node->op, node->a, node->b, node->k) & mask;
+	while (g->cse[i])
+		i = (i + 1) & mask;
+	g->cse[i] = n + 1;
+	g->cse_used++;
+}
+
+static void cse_grow(struct formula_graph *g)
+{
+	if (g->cse_size && (g->cse_used + 1) * 2 <= g->cse_size)
+		return;
+
+	size_t n;
+	free(g->cse);
+	g->cse_size = g->cse_size ? g->cse_size * 2 : 256;
+	g->cse_used = 0;
+	g->cse = calloc(g->cse_size, sizeof(*g->cse));
+	if (!g->cse)
+		err(1, "alloc failure");
+	for (n = 0; n < g->node_count; n++)
+		cse_insert(g, n);
+}
+
+/* The node for (@op @a @b), or @k, or input @a, created if needed */
+static unsigned node_get(struct formula_graph *g, unsigned op,
+		unsigned a, unsigned b, double k)
+{
+	if (op >= FG_ADD) {
+		if (g->nodes[a].op == FG_CONST && g->nodes[b].op == FG_CONST)
+			return node_get(g, FG_CONST, 0, 0,
+					fg_apply(op, g->nodes[a].k, g->nodes[b].k));
+		if ((op == FG_ADD || op == FG_MUL) && a > b) {
+			unsigned t = a;
+			a = b;
+			b = t;
+		}
+		k = 0;
+	}
+
+	cse_grow(g);
+
+	size_t mask = g->cse_size - 1;
+	size_t i = node_hash(op, a, b, k) & mask;
+	for (; g->cse[i]; i = (i + 1) & mask) {
+		struct fg_node *node = &g->nodes[g->cse[i] - 1];
+		if (node->op == op && node->a == a && node->b == b &&
+				double_bits(node->k) == double_bits(k))
+			return g->cse[i] - 1;
+	}
+
+	size_t alloc = g->node_alloc;
+	g->nodes = grow(g->nodes, &g->node_alloc, g->node_count + 1, sizeof(*g->nodes));
+	if (alloc != g->node_alloc) {
+		g->values = realloc(g->values, g->node_alloc * g->instances * sizeof(*g->values));
+		g->changed = realloc(g->changed, g->node_alloc * sizeof(*g->changed));
+		if ((!g->values && g->instances) || !g->changed)
+			err(1, "alloc failure");
+	}
+
+	unsigned n = g->node_count++;
+	g->nodes[n] = (struct fg_node) {
+		.op = op,
+		.a = a,
+		.b = b,
+		.k = k,
+		.tree = op >= FG_ADD ? 1 + g->nodes[a].tree + g->nodes[b].tree : 1,
+	};
+
+	double *v = g->values + (size_t)n * g->instances;
+	for (i = 0; i < g->instances; i++)
+		v[i] = op == FG_CONST ? k : 0;
+	g->changed[n] = true;
+
+	cse_insert(g, n);
+	return n;
+}
+
+static struct fg_formula *find_formula(struct formula_graph *g,
+		const char *name, size_t len)
+{
+	size_t i;
+	for (i = 0; i < g->formula_count; i++)
+		if (g->formulas[i].name_len == len &&
+				!memcmp(g->formulas[i].name, name, len))
+			return &g->formulas[i];
+	return NULL;
+}
+
+int formula_graph_find_input(struct formula_graph *g, const char *name, size_t name_len)
+{
+	size_t i;
+	for (i = 0; i < g->input_count; i++)
+		if (g->inputs[i].len == name_len &&
+				!memcmp(g->inputs[i].name, name, name_len))
+			return i;
+	return -1;
+}
+
+/* The node for an event or builtin, -1 if @name is neither */
+static int input_node(struct formula_graph *g, const char *name, size_t len)
+{
+	int i = formula_graph_find_input(g, name, len);
+	if (i != -1)
+		return g->inputs[i].node;
+
+	const char *n = NULL;
+	size_t j, l;
+	struct catalog_event *ev = catalog_find_event(g->c, name, len);
+	if (ev) {
+		n = event_name(ev->data, &l);
+	} else {
+		for (j = 0; j < ARRAY_SIZE(builtins); j++)
+			if (strlen(builtins[j]) == len && !memcmp(builtins[j], name, len))
+				n = builtins[j];
+	}
+	if (!n)
+		return -1;
+
+	g->inputs = grow(g->inputs, &g->input_alloc, g->input_count + 1, sizeof(*g->inputs));
+	struct fg_input *in = &g->inputs[g->input_count];
+	in->name = n;
+	in->len = len;
+	in->node = node_get(g, FG_INPUT, g->input_count, 0, 0);
+	g->input_count++;
+	return in->node;
+}
+
+int formula_graph_add(struct formula_graph *g, const char *name, size_t name_len,
+		const char *text, size_t text_len)
+{
+	if (find_formula(g, name, name_len)) {
+		warnx("formula %.*s is defined twice", (int)name_len, name);
+		return -1;
+	}
+
+	g->formulas = grow(g->formulas, &g->formula_alloc, g->formula_count + 1,
+			sizeof(*g->formulas));
+	struct fg_formula *f = &g->formulas[g->formula_count];
+	*f = (struct fg_formula) {
+		.name = malloc(name_len + 1),
+		.text = malloc(text_len + 1),
+		.name_len = name_len,
+		.text_len = text_len,
+	};
+	if (!f->name || !f->text)
+		err(1, "alloc failure");
+	memcpy(f->name, name, name_len);
+	f->name[name_len] = '\0';
+	memcpy(f->text, text, text_len);
+	f->text[text_len] = '\0';
+
+	return g->formula_count++;
+}
+
+int formula_graph_add_catalog(struct formula_graph *g)
+{
+	size_t i, nl, tl;
+	int added = 0;
+	for (i = 0; i < g->c->formula_count; i++) {
+		struct hv_24x7_formula_data *f = g->c->formulas[i];
+		const char *name = formula_name(f, &nl);
+		const char *text = formula_text(f, &tl);
+
+		/* already pulled in by a formula that refers to it, or given */
+		nl = catalog_name_trim(name, nl);
+		if (find_formula(g, name, nl))
+			continue;
+		if (formula_graph_add(g, name, nl, text, catalog_name_trim(text, tl)) < 0)
+			return -1;
+		added++;
+	}
+	return added;
+}
+
+static unsigned token_op(const char *tok, size_t len)
+{
+	static const struct {
+		const char *name;
+		unsigned op;
+	} ops[] = {
+		{ "+", FG_ADD },
+		{ "-", FG_SUB },
+		{ "*", FG_MUL },
+		{ "/", FG_DIV },
+		{ "mod", FG_MOD },
+		{ "rem", FG_REM },
+		{ "x^y", FG_POW },
+	};
+	size_t i;
+	for (i = 0; i < ARRAY_SIZE(ops); i++)
+		if (strlen(ops[i].name) == len && !memcmp(ops[i].name, tok, len))
+			return ops[i].op;
+	return FG_INPUT;
+}
+
+/* Numbers are decimal (or hex) only, so names like "inf" stay names */
+static bool token_number(const char *tok, size_t len, double *v)
+{
+	char buf[64], *end;
+	const char *d = tok + (*tok == '-' || *tok == '+');
+
+	if (len >= sizeof(buf) || d == tok + len ||
+			!(isdigit((unsigned char)*d) || *d == '.'))
+		return false;
+
+	memcpy(buf, tok, len);
+	buf[len] = '\0';
+	*v = strtod(buf, &end);
+	return end == buf + len;
+}
+
+static int compile_formula(struct formula_graph *g, size_t ix);
+
+/* The node for @tok, compiling the formula it names if it is one */
+static int compile_name(struct formula_graph *g, const char *formula,
+		const char *tok, size_t len)
+{
+	struct fg_formula *f = find_formula(g, tok, len);
+	if (f) {
+		size_t ix = f - g->formulas;
+		if (compile_formula(g, ix))
+			return -1;
+		return g->formulas[ix].node;
+	}
+
+	/* a catalog formula referred to before formula_graph_add_catalog() */
+	struct hv_24x7_formula_data *cf = catalog_find_formula(g->c, tok, len);
+	if (cf) {
+		size_t tl;
+		const char *text = formula_text(cf, &tl);
+		int ix = formula_graph_add(g, tok, len, text, catalog_name_trim(text, tl));
+		if (ix < 0 || compile_formula(g, ix))
+			return -1;
+		return g->formulas[ix].node;
+	}
+
+	int n = input_node(g, tok, len);
+	if (n < 0)
+		warnx("formula %s: unknown name '%.*s'", formula, (int)len, tok);
+	return n;
+}
+
+static int compile_formula(struct formula_graph *g, size_t ix)
+{
+	struct fg_formula *f = &g->formulas[ix];
+	unsigned stack[FG_STACK_MAX], t;
+	const char *tok = NULL;
+	size_t depth = 0, len = 0;
+	double v;
+	int n;
+
+	if (f->state == FG_COMPILED)
+		return 0;
+	if (f->state == FG_COMPILING) {
+		warnx("formula %s refers to itself", f->name);
+		return -1;
+	}
+	f->state = FG_COMPILING;
+
+	/* @f moves if referenced catalog formulas get added, the text doesn't */
+	const char *name = f->name, *p = f->text, *end = f->text + f->text_len;
+	for (;;) {
+		while (p < end && isspace((unsigned char)*p))
+			p++;
+		if (p == end)
+			break;
+
+		tok = p;
+		while (p < end && !isspace((unsigned char)*p))
+			p++;
+		len = p - tok;
+
+		unsigned op = token_op(tok, len);
+		if (op != FG_INPUT) {
+			if (depth < 2)
+				goto underflow;
+			depth--;
+			stack[depth - 1] = node_get(g, op, stack[depth - 1], stack[depth], 0);
+			continue;
+		}
+
+		if (len == 3 && !memcmp(tok, "sqr", 3)) {
+			if (depth < 1)
+				goto underflow;
+			stack[depth - 1] = node_get(g, FG_MUL, stack[depth - 1], stack[depth - 1], 0);
+			continue;
+		}
+
+		if (len == 3 && !memcmp(tok, "rot", 3)) {
+			if (depth < 3)
+				goto underflow;
+			t = stack[depth - 3];
+			stack[depth - 3] = stack[depth - 2];
+			stack[depth - 2] = stack[depth - 1];
+			stack[depth - 1] = t;
+			continue;
+		}
+
+		if (depth == FG_STACK_MAX) {
+			warnx("formula %s: more than %d values on the stack", name, FG_STACK_MAX);
+			goto fail;
+		}
+
+		if (len == 3 && !memcmp(tok, "dup", 3)) {
+			if (depth < 1)
+				goto underflow;
+			stack[depth] = stack[depth - 1];
+			depth++;
+			continue;
+		}
+
+		if (token_number(tok, len, &v)) {
+			stack[depth++] = node_get(g, FG_CONST, 0, 0, v);
+			continue;
+		}
+
+		n = compile_name(g, name, tok, len);
+		if (n < 0)
+			goto fail;
+		stack[depth++] = n;
+	}
+
+	if (depth != 1) {
+		warnx("formula %s leaves %zu values on the stack", name, depth);
+		goto fail;
+	}
+
+	g->formulas[ix].node = stack[0];
+	g->formulas[ix].state = FG_COMPILED;
+	pr_debug(2, "formula %s: node %u, tree of %zu", name, stack[0],
+			g->nodes[stack[0]].tree);
+	return 0;
+
+underflow:
+	warnx("formula %s: not enough values for '%.*s'", name, (int)len, tok);
+fail:
+	g->formulas[ix].state = FG_ADDED;
+	return -1;
+}
+
+int formula_graph_compile(struct formula_graph *g)
+{
+	for (; g->compiled < g->formula_count; g->compiled++)
+		if (compile_formula(g, g->compiled))
+			return -1;
+	return 0;
+}
+
+size_t formula_graph_formula_count(struct formula_graph *g)
+{
+	return g->formula_count;
+}
+
+const char *formula_graph_formula_name(struct formula_graph *g, size_t formula, size_t *len)
+{
+	*len = g->formulas[formula].name_len;
+	return g->formulas[formula].name;
+}
+
+const double *formula_graph_values(struct formula_graph *g, size_t formula)
+{
+	struct fg_formula *f = &g->formulas[formula];
+	if (f->state != FG_COMPILED)
+		return NULL;
+	return g->values + (size_t)f->node * g->instances;
+}
+
+size_t formula_graph_input_count(struct formula_graph *g)
+{
+	return g->input_count;
+}
+
+const char *formula_graph_input_name(struct formula_graph *g, size_t input, size_t *len)
+{
+	*len = g->inputs[input].len;
+	return g->inputs[input].name;
+}
+
+void formula_graph_set(struct formula_graph *g, size_t input, size_t instance, double v)
+{
+	unsigned n = g->inputs[input].node;
+	double *p = g->values + (size_t)n * g->instances + instance;
+	if (double_bits(*p) != double_bits(v)) {
+		*p = v;
+		g->changed[n] = true;
+	}
+}
+
+void formula_graph_set_all(struct formula_graph *g, size_t input, const double *v)
+{
+	unsigned n = g->inputs[input].node;
+	double *p = g->values + (size_t)n * g->instances;
+	size_t bytes = g->instances * sizeof(*p);
+	if (memcmp(p, v, bytes)) {
+		memcpy(p, v, bytes);
+		g->changed[n] = true;
+	}
+}
+
+#define EVAL_LOOP(expr) do {				\
+	for (i = 0; i < m; i++) {			\
+		double x = xs[i], y = ys[i];		\
+		r[i] = (expr);				\
+	}						\
+} while (0)
+
+size_t formula_graph_eval(struct formula_graph *g)
+{
+	size_t n, i, m = g->instances, recomputed = 0;
+	double *r = g->scratch;
+
+	for (n = 0; n < g->node_count; n++) {
+		struct fg_node *node = &g->nodes[n];
+		if (node->op < FG_ADD ||
+				!(g->changed[n] || g->changed[node->a] || g->changed[node->b]))
+			continue;
+
+		const double *xs = g->values + (size_t)node->a * m;
+		const double *ys = g->values + (size_t)node->b * m;
+		double *out = g->values + n * m;
+
+		switch (node->op) {
+		case FG_ADD:
+			EVAL_LOOP(x + y);
+			break;
+		case FG_SUB:
+			EVAL_LOOP(x - y);
+			break;
+		case FG_MUL:
+			EVAL_LOOP(x * y);
+			break;
+		case FG_DIV:
+			EVAL_LOOP(x / y);
+			break;
+		default:
+			EVAL_LOOP(fg_apply(node->op, x, y));
+			break;
+		}
+
+		/* same values as last time: nothing above needs recomputing for this */
+		if (memcmp(out, r, m * sizeof(*r))) {
+			memcpy(out, r, m * sizeof(*r));
+			g->changed[n] = true;
+		}
+		recomputed++;
+	}
+
+	if (g->node_count)
+		memset(g->changed, 0, g->node_count * sizeof(*g->changed));
+	return recomputed;
+}
+
+void formula_graph_invalidate(struct formula_graph *g)
+{
+	size_t n;
+	for (n = 0; n < g->node_count; n++)
+		g->changed[n] = true;
+}
+
+void formula_graph_stats(struct formula_graph *g, struct formula_graph_stats *st)
+{
+	size_t i;
+
+	*st = (struct formula_graph_stats) {
+		.formulas = g->formula_count,
+		.inputs = g->input_count,
+		.nodes = g->node_count,
+	};
+	for (i = 0; i < g->formula_count; i++)
+		if (g->formulas[i].state == FG_COMPILED)
+			st->tree_nodes += g->nodes[g->formulas[i].node].tree;
+}
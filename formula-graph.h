@@ -0,0 +1,111 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef FORMULA_GRAPH_H_
+#define FORMULA_GRAPH_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "catalog.h"
+
+/*
+ * Formulas are postfix, whitespace separated:
+ *
+ *   numbers     pushed as constants
+ *   names       the formula of that name, else the (delta of the) event of
+ *               that name, else one of "delta-timebase", "delta-cycles",
+ *               "delta-instructions" or "delta-seconds"
+ *   + - * /     pop y, pop x, push x op y
+ *   mod rem     x mod y has the sign of y, x rem y that of x
+ *   x^y         pop y, pop x, push x raised to y
+ *   sqr         x * x
+ *   dup         x -- x x
+ *   rot         x y z -- y z x
+ *
+ * ie: "PM_RUN_INST_CMPL PM_RUN_CYC /" or "delta-cycles delta-seconds / 1e6 /"
+ *
+ * Every formula added to a graph is compiled into the same set of nodes:
+ * identical subexpressions (after folding constants and ordering the
+ * operands of + and *) are one node, and referenced formulas are inlined.
+ * Nodes only refer to nodes created before them, so evaluating them in
+ * order is a topological walk.
+ *
+ * Each node holds one value per instance (chip, core, vcpu, ...) in a
+ * contiguous array. Only nodes below an input whose value changed since
+ * the last formula_graph_eval() are recomputed, and a node whose values
+ * come out the same stops the change from going further.
+ *
+ * Arithmetic is plain IEEE double: x / 0 is inf or nan.
+ */
+
+struct formula_graph;
+
+/* @c must outlive the graph */
+struct formula_graph *formula_graph_new(struct catalog *c, size_t instances);
+void formula_graph_free(struct formula_graph *g);
+
+/*
+ * Add a formula. It is compiled by formula_graph_compile(), so it may
+ * refer to formulas added after it. Returns the formula's index, -1 if the
+ * name is already used.
+ */
+int formula_graph_add(struct formula_graph *g, const char *name, size_t name_len,
+		const char *text, size_t text_len);
+
+/*
+ * Add every formula of the catalog that isn't in the graph yet: compiling
+ * a formula that refers to a catalog formula adds it, and a formula added
+ * under a catalog formula's name replaces it. Returns the number added, -1
+ * on error.
+ */
+int formula_graph_add_catalog(struct formula_graph *g);
+
+/*
+ * Compile every formula added since the last call. Returns -1 (after
+ * warning) on the first formula that is malformed, refers to an unknown
+ * name or (indirectly) to itself.
+ */
+int formula_graph_compile(struct formula_graph *g);
+
+size_t formula_graph_formula_count(struct formula_graph *g);
+const char *formula_graph_formula_name(struct formula_graph *g, size_t formula, size_t *len);
+/* The values of a compiled formula, one per instance */
+const double *formula_graph_values(struct formula_graph *g, size_t formula);
+
+/* Inputs are the event and delta-* names used by the compiled formulas */
+size_t formula_graph_input_count(struct formula_graph *g);
+const char *formula_graph_input_name(struct formula_graph *g, size_t input, size_t *len);
+/* Returns -1 if no compiled formula uses @name */
+int formula_graph_find_input(struct formula_graph *g, const char *name, size_t name_len);
+
+void formula_graph_set(struct formula_graph *g, size_t input, size_t instance, double v);
+/* @v has one value per instance */
+void formula_graph_set_all(struct formula_graph *g, size_t input, const double *v);
+
+/*
+ * Bring every formula up to date with the inputs. Returns the number of
+ * nodes recomputed.
+ */
+size_t formula_graph_eval(struct formula_graph *g);
+
+/* Make the next formula_graph_eval() recompute every node */
+void formula_graph_invalidate(struct formula_graph *g);
+
+struct formula_graph_stats {
+	size_t formulas;
+	size_t inputs;
+	/* inputs, constants and operations, after merging */
+	size_t nodes;
+	/* nodes the formulas would need if each was a tree of its own */
+	size_t tree_nodes;
+};
+
+void formula_graph_stats(struct formula_graph *g, struct formula_graph_stats *st);
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/*
+ * Compile a catalog's formulas (and any given on the side) into one graph
+ * and evaluate it over made up intervals, to see what merging and
+ * incremental recomputation save.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <time.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+
+#include "catalog.h"
+#include "formula-graph.h"
+
+static void _usage(const char *p, int e)
+{
+	FILE *o = stderr;
+	fprintf(o,
+"usage: %s [options] <catalog>\n"
+"\n"
+"Evaluate every formula of the catalog for a number of instances, with a\n"
+"fraction of the inputs changing each interval.\n"
+"\n"
+"  -f file    more formulas, one 'name = formula' per line, '-' for stdin\n"
+"  -i count   instances (default: 64)\n"
+"  -n count   intervals (default: 100)\n"
+"  -u percent of inputs that change each interval (default: 10)\n"
+"  -p         print every formula's value for instance 0 at the end\n", p);
+	exit(e);
+}
+
+#define _PRGM_NAME "formula-eval"
+#define PRGM_NAME  (argc?argv[0]:_PRGM_NAME)
+#define usage(argc, argv, e) _usage(PRGM_NAME, e)
+#define U(e) usage(argc, argv, e)
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t rand_state = 0x2545f4914f6cdd1dULL;
+
+static uint64_t next_rand(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+	return rand_state;
+}
+
+static int add_file(struct formula_graph *g, const char *file)
+{
+	FILE *f = strcmp(file, "-") ? fopen(file, "r") : stdin;
+	char line[4096];
+	unsigned lineno = 0;
+	int ret = 0;
+
+	if (!f) {
+		warn("could not open %s", file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *name = line, *eq, *end;
+		lineno++;
+
+		while (isspace((unsigned char)*name))
+			name++;
+		if (!*name || *name == '#')
+			continue;
+
+		eq = strchr(name, '=');
+		if (!eq) {
+			warnx("%s:%u: expected 'name = formula'", file, lineno);
+			ret = -1;
+			break;
+		}
+
+		for (end = eq; end > name && isspace((unsigned char)end[-1]); end--)
+			;
+		if (formula_graph_add(g, name, end - name, eq + 1, strcspn(eq + 1, "\n")) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (f != stdin)
+		fclose(f);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *file = NULL;
+	size_t instances = 64, i, j;
+	unsigned long intervals = 100, n;
+	unsigned percent = 10;
+	bool print = false;
+	int opt;
+
+	err_set_progname(PRGM_NAME);
+
+	while ((opt = getopt(argc, argv, "f:i:n:u:ph")) != -1) {
+		switch (opt) {
+		case 'f':
+			file = optarg;
+			break;
+		case 'i':
+			instances = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			intervals = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			percent = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			print = true;
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (argc - optind != 1 || !instances || percent > 100)
+		U(1);
+
+	struct catalog c;
+	if (catalog_load(&c, argv[optind]))
+		return 1;
+
+	struct formula_graph *g = formula_graph_new(&c, instances);
+	if (formula_graph_add_catalog(g) < 0 || (file && add_file(g, file)) ||
+			formula_graph_compile(g))
+		return 1;
+
+	struct formula_graph_stats st;
+	formula_graph_stats(g, &st);
+	printf("%zu formulas, %zu inputs, %zu nodes (%zu without merging)\n",
+			st.formulas, st.inputs, st.nodes, st.tree_nodes);
+	if (!st.formulas)
+		errx(1, "no formulas to evaluate");
+
+	double *v = malloc(instances * sizeof(*v));
+	if (!v)
+		err(1, "alloc failure");
+
+	uint64_t incremental_ns = 0, recomputed = 0;
+	for (n = 0; n <= intervals; n++) {
+		for (i = 0; i < st.inputs; i++) {
+			if (n && next_rand() % 100 >= percent)
+				continue;
+			for (j = 0; j < instances; j++)
+				v[j] = next_rand() % 1000000 + 1;
+			formula_graph_set_all(g, i, v);
+		}
+
+		uint64_t t0 = now_ns();
+		size_t r = formula_graph_eval(g);
+		/* the first interval computes everything */
+		if (n) {
+			incremental_ns += now_ns() - t0;
+			recomputed += r;
+		}
+	}
+
+	/* the incremental results must be what evaluating everything gives */
+	double **results = calloc(st.formulas, sizeof(*results));
+	if (!results)
+		err(1, "alloc failure");
+	for (i = 0; i < st.formulas; i++) {
+		results[i] = malloc(instances * sizeof(**results));
+		if (!results[i])
+			err(1, "alloc failure");
+		memcpy(results[i], formula_graph_values(g, i), instances * sizeof(**results));
+	}
+
+	uint64_t t0 = now_ns();
+	formula_graph_invalidate(g);
+	size_t all = formula_graph_eval(g);
+	uint64_t full_ns = now_ns() - t0;
+
+	size_t mismatches = 0;
+	for (i = 0; i < st.formulas; i++)
+		if (memcmp(results[i], formula_graph_values(g, i), instances * sizeof(**results)))
+			mismatches++;
+
+	if (intervals)
+		printf("%lu intervals: %.1f of %zu nodes recomputed, %.3f us per interval, %.3f us to recompute all\n",
+				intervals, (double)recomputed / intervals, all,
+				incremental_ns / 1e3 / intervals, full_ns / 1e3);
+	if (mismatches)
+		warnx("%zu formulas differ from a full recompute", mismatches);
+
+	if (print) {
+		for (i = 0; i < st.formulas; i++) {
+			size_t nl;
+			const char *name = formula_graph_formula_name(g, i, &nl);
+			printf("%.*s = %g\n", (int)nl, name, formula_graph_values(g, i)[0]);
+		}
+	}
+
+	for (i = 0; i < st.formulas; i++)
+		free(results[i]);
+	free(results);
+	free(v);
+	formula_graph_free(g);
+	catalog_free(&c);
+	return !!mismatches;
+}
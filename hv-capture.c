@@ -0,0 +1,203 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+#include <ccan/endian/endian.h>
+
+#include "hv-capture.h"
+
+struct hv_capture_writer {
+	FILE *f;
+	uint64_t records;
+};
+
+struct hv_capture_reader {
+	unsigned char *map;
+	size_t map_len;
+	size_t pos;
+	uint64_t catalog_version;
+};
+
+static size_t record_padding(size_t len)
+{
+	return (8 - (len & 7)) & 7;
+}
+
+struct hv_capture_writer *hv_capture_create(const char *file, uint64_t catalog_version,
+		const uint8_t *build_time_stamp)
+{
+	struct hv_capture_header h;
+
+	FILE *f = fopen(file, "wb");
+	if (!f) {
+		warn("could not open %s", file);
+		return NULL;
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, HV_CAPTURE_MAGIC, sizeof(h.magic));
+	h.version = cpu_to_be32(HV_CAPTURE_VERSION);
+	h.catalog_version = cpu_to_be64(catalog_version);
+	if (build_time_stamp)
+		memcpy(h.build_time_stamp, build_time_stamp, sizeof(h.build_time_stamp));
+
+	if (fwrite(&h, sizeof(h), 1, f) != 1) {
+		warn("could not write capture header to %s", file);
+		fclose(f);
+		return NULL;
+	}
+
+	struct hv_capture_writer *w = calloc(1, sizeof(*w));
+	if (!w)
+		err(1, "alloc failure");
+	w->f = f;
+	return w;
+}
+
+int hv_capture_write(struct hv_capture_writer *w, uint64_t timestamp_ns,
+		const void *request, size_t request_len,
+		const void *result, size_t result_len)
+{
+	static const char zero[8];
+	struct hv_capture_record rec = {
+		.timestamp_ns = cpu_to_be64(timestamp_ns),
+		.request_len = cpu_to_be32(request_len),
+		.result_len = cpu_to_be32(result_len),
+	};
+	size_t pad = record_padding(request_len + result_len);
+
+	if (fwrite(&rec, sizeof(rec), 1, w->f) != 1 ||
+			fwrite(request, 1, request_len, w->f) != request_len ||
+			fwrite(result, 1, result_len, w->f) != result_len ||
+			fwrite(zero, 1, pad, w->f) != pad) {
+		warn("capture write failure");
+		return -1;
+	}
+
+	w->records++;
+	return 0;
+}
+
+int hv_capture_close(struct hv_capture_writer *w)
+{
+	int ret = 0;
+	if (fclose(w->f)) {
+		warn("capture close failure");
+		ret = -1;
+	}
+
+	pr_debug(1, "wrote %"PRIu64" records", w->records);
+	free(w);
+	return ret;
+}
+
+struct hv_capture_reader *hv_capture_open(const char *file)
+{
+	struct hv_capture_reader *r;
+	struct stat st;
+
+	int fd = open(file, O_RDONLY);
+	if (fd == -1) {
+		warn("could not open %s", file);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(struct hv_capture_header)) {
+		warnx("%s: too short to be a capture", file);
+		close(fd);
+		return NULL;
+	}
+
+	void *m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) {
+		warn("could not map %s", file);
+		return NULL;
+	}
+
+	struct hv_capture_header *h = m;
+	if (memcmp(h->magic, HV_CAPTURE_MAGIC, sizeof(h->magic)) ||
+			be32_to_cpu(h->version) != HV_CAPTURE_VERSION) {
+		warnx("%s: not a (supported) capture", file);
+		munmap(m, st.st_size);
+		return NULL;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		err(1, "alloc failure");
+	r->map = m;
+	r->map_len = st.st_size;
+	r->pos = sizeof(*h);
+	r->catalog_version = be64_to_cpu(h->catalog_version);
+	/* records are read in order, once */
+	madvise(r->map, r->map_len, MADV_SEQUENTIAL);
+	return r;
+}
+
+void hv_capture_reader_close(struct hv_capture_reader *r)
+{
+	munmap(r->map, r->map_len);
+	free(r);
+}
+
+uint64_t hv_capture_catalog_version(struct hv_capture_reader *r)
+{
+	return r->catalog_version;
+}
+
+void hv_capture_rewind(struct hv_capture_reader *r)
+{
+	r->pos = sizeof(struct hv_capture_header);
+}
+
+int hv_capture_next(struct hv_capture_reader *r, uint64_t *timestamp_ns,
+		const void **request, size_t *request_len,
+		const void **result, size_t *result_len)
+{
+	size_t left = r->map_len - r->pos;
+	struct hv_capture_record rec;
+
+	if (!left)
+		return 0;
+
+	if (left < sizeof(rec)) {
+		warnx("capture truncated in a record header at %zu", r->pos);
+		return -1;
+	}
+
+	memcpy(&rec, r->map + r->pos, sizeof(rec));
+	size_t req_len = be32_to_cpu(rec.request_len);
+	size_t res_len = be32_to_cpu(rec.result_len);
+	size_t len = sizeof(rec) + req_len + res_len;
+	len += record_padding(req_len + res_len);
+	if (len > left) {
+		warnx("capture truncated in the record at %zu", r->pos);
+		return -1;
+	}
+
+	*timestamp_ns = be64_to_cpu(rec.timestamp_ns);
+	*request = r->map + r->pos + sizeof(rec);
+	*request_len = req_len;
+	*result = r->map + r->pos + sizeof(rec) + req_len;
+	*result_len = res_len;
+
+	r->pos += len;
+	return 1;
+}
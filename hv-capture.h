@@ -0,0 +1,80 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef HV_CAPTURE_H_
+#define HV_CAPTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Captures of H_GET_24X7_DATA calls: the request buffer as it was passed to
+ * the hypervisor and the result buffer it returned, both kept byte for byte
+ * (big endian), along with when the call was made. Replaying a capture
+ * through hv-decode.h exercises the same code as live collection, without
+ * needing the hardware (or the HMC setting) to produce the data.
+ *
+ * The framing is big endian too, so a capture is big endian throughout.
+ *
+ * File:
+ *	struct hv_capture_header
+ *	record[]
+ *
+ * Record:
+ *	struct hv_capture_record
+ *	request buffer (request_len bytes)
+ *	result buffer (result_len bytes)
+ *	(padding to 8 bytes)
+ */
+
+#define HV_CAPTURE_MAGIC "24x7CAPT"
+#define HV_CAPTURE_VERSION 1
+
+struct hv_capture_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	/* of the catalog the requests were built from */
+	uint64_t catalog_version;
+	uint8_t build_time_stamp[16];
+} __attribute__((__packed__));
+
+struct hv_capture_record {
+	/* CLOCK_MONOTONIC, when the call was made */
+	uint64_t timestamp_ns;
+	uint32_t request_len;
+	uint32_t result_len;
+} __attribute__((__packed__));
+
+struct hv_capture_writer;
+struct hv_capture_reader;
+
+/* @build_time_stamp may be NULL */
+struct hv_capture_writer *hv_capture_create(const char *file, uint64_t catalog_version,
+		const uint8_t *build_time_stamp);
+int hv_capture_write(struct hv_capture_writer *w, uint64_t timestamp_ns,
+		const void *request, size_t request_len,
+		const void *result, size_t result_len);
+int hv_capture_close(struct hv_capture_writer *w);
+
+struct hv_capture_reader *hv_capture_open(const char *file);
+void hv_capture_reader_close(struct hv_capture_reader *r);
+uint64_t hv_capture_catalog_version(struct hv_capture_reader *r);
+
+/* Start over from the first record */
+void hv_capture_rewind(struct hv_capture_reader *r);
+
+/*
+ * Returns 1 and points @request and @result into the (mapped) capture,
+ * 0 at the end of the capture, -1 if the capture is truncated or corrupt.
+ */
+int hv_capture_next(struct hv_capture_reader *r, uint64_t *timestamp_ns,
+		const void **request, size_t *request_len,
+		const void **result, size_t *result_len);
+
+#endif
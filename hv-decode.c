@@ -0,0 +1,479 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+#include <ccan/endian/endian.h>
+
+#include <penny/penny.h>
+
+#include "hv-decode.h"
+
+struct decode_counter {
+	const struct catalog_event *event;
+	/* within the element data */
+	unsigned offset;
+	/* the domain and counter part of the previous value's key */
+	uint64_t key;
+};
+
+struct decode_request {
+	unsigned domain;
+	unsigned data_size;
+	/* within the element data, -1 if the request is not a group record */
+	int timebase_offset;
+	size_t first_counter, counter_count;
+};
+
+struct decode_plan {
+	/* the request buffer this plan was built for, NULL for an unused slot */
+	unsigned char *request;
+	size_t request_len;
+	uint64_t last_used;
+
+	struct decode_request *requests;
+	size_t request_count;
+	struct decode_counter *counters;
+	size_t counter_count;
+};
+
+/*
+ * Collection splits its requests over as many calls as it takes to fit the
+ * result buffer (a page), and cycles through them: keep a plan for each.
+ * Every core group of 32 cores already takes over a hundred calls.
+ */
+#define DECODE_PLANS_MAX 1024
+
+struct prev_value {
+	/* 0 for an empty slot */
+	uint64_t key;
+	uint64_t value;
+	/* timebase if @is_timebase, otherwise timestamp_ns */
+	uint64_t time;
+	bool is_timebase;
+};
+
+struct hv_decoder {
+	struct catalog *c;
+	uint64_t timebase_hz;
+
+	/* events sorted by event_offset() */
+	struct catalog_event **by_offset;
+
+	struct decode_plan *plans;
+	size_t plan_count, plan_alloc, plan_last;
+	uint64_t plan_uses;
+
+	/*
+	 * open addressing, keyed by domain, counter offset, domain index and
+	 * lpar: whichever request buffer reads a counter, it is the same
+	 * counter.
+	 */
+	struct prev_value *prev;
+	size_t prev_size, prev_used;
+};
+
+static uint64_t load_be64(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return be64_to_cpu(v);
+}
+
+static int event_offset_cmp(const void *a_, const void *b_)
+{
+	struct catalog_event *const *a = a_, *const *b = b_;
+	unsigned ao = event_offset((*a)->data), bo = event_offset((*b)->data);
+	if (ao != bo)
+		return ao < bo ? -1 : 1;
+	return (*a)->ix < (*b)->ix ? -1 : (*a)->ix > (*b)->ix;
+}
+
+struct hv_decoder *hv_decoder_new(struct catalog *c, uint64_t timebase_hz)
+{
+	struct hv_decoder *d = calloc(1, sizeof(*d));
+	size_t i;
+
+	if (!d)
+		err(1, "alloc failure");
+
+	d->c = c;
+	d->timebase_hz = timebase_hz;
+	d->by_offset = malloc(sizeof(*d->by_offset) * c->event_count);
+	if (!d->by_offset && c->event_count)
+		err(1, "alloc failure");
+	for (i = 0; i < c->event_count; i++)
+		d->by_offset[i] = &c->events[i];
+	qsort(d->by_offset, c->event_count, sizeof(*d->by_offset), event_offset_cmp);
+
+	return d;
+}
+
+void hv_decoder_reset(struct hv_decoder *d)
+{
+	if (d->prev)
+		memset(d->prev, 0, sizeof(*d->prev) * d->prev_size);
+	d->prev_used = 0;
+}
+
+static void plan_free(struct decode_plan *plan)
+{
+	free(plan->request);
+	free(plan->requests);
+	free(plan->counters);
+	memset(plan, 0, sizeof(*plan));
+}
+
+void hv_decoder_free(struct hv_decoder *d)
+{
+	size_t i;
+
+	for (i = 0; i < d->plan_count; i++)
+		plan_free(&d->plans[i]);
+	free(d->plans);
+	free(d->prev);
+	free(d->by_offset);
+	free(d);
+}
+
+static bool event_in_domain(struct catalog_event *ev, unsigned domain)
+{
+	unsigned domains[CATALOG_EVENT_DOMAINS_MAX];
+	size_t i, n = event_domains(ev->data, domains);
+	for (i = 0; i < n; i++)
+		if (domains[i] == domain)
+			return true;
+	return false;
+}
+
+/*
+ * If @data_offset/@data_size is exactly one of the catalog's group records,
+ * returns where that group's schema puts the timebase. Otherwise -1.
+ */
+static int group_timebase_offset(struct catalog *c, unsigned domain,
+		unsigned data_offset, unsigned data_size)
+{
+	/* groups are listed under the physical domains only */
+	unsigned group_domain = domain == HV_PERF_DOMAIN_PHYSICAL_CHIP ?
+		HV_PERF_DOMAIN_PHYSICAL_CHIP : HV_PERF_DOMAIN_PHYSICAL_CORE;
+	size_t i, j;
+
+	for (i = 0; i < c->group_count; i++) {
+		struct hv_24x7_group_data *g = c->groups[i];
+		if (g->domain != group_domain ||
+				be_to_cpu(g->event_group_record_offs) != data_offset ||
+				be_to_cpu(g->event_group_record_len) != data_size)
+			continue;
+
+		if (g->group_schema_ix >= c->schema_count)
+			return -1;
+
+		struct hv_24x7_grs *s = c->schemas[g->group_schema_ix];
+		struct hv_24x7_grs_field *f = (void *)s->field_entrys;
+		for (j = 0; j < be_to_cpu(s->field_entry_count); j++) {
+			unsigned offs = be_to_cpu(f[j].offs);
+			if (be_to_cpu(f[j].field_enum) == GRS_TIMEBASE_UPDATE &&
+					be_to_cpu(f[j].length) == 8 &&
+					offs + 8 <= data_size)
+				return offs;
+		}
+		return -1;
+	}
+
+	return -1;
+}
+
+/* First entry of @d->by_offset whose offset is >= @offset */
+static size_t lower_bound(struct hv_decoder *d, unsigned offset)
+{
+	size_t lo = 0, hi = d->c->event_count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (event_offset(d->by_offset[mid]->data) < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Previous values are keyed by this, with the lpar and domain index below */
+static uint64_t counter_key(unsigned domain, unsigned offset)
+{
+	/* catalog counter offsets are 16 bits */
+	return (uint64_t)(domain & 0xff) << 48 | (uint64_t)(offset & 0xffff) << 32;
+}
+
+static void plan_build(struct hv_decoder *d, struct decode_plan *plan,
+		const struct hv_24x7_request_buffer *rb, size_t request_len)
+{
+	size_t i, j, n = rb->num_requests, alloc = 0;
+
+	plan->requests = calloc(n, sizeof(*plan->requests));
+	if (!plan->requests && n)
+		err(1, "alloc failure");
+
+	for (i = 0; i < n; i++) {
+		const struct hv_24x7_request *req = &rb->requests[i];
+		struct decode_request *dr = &plan->requests[i];
+		unsigned data_offset = be_to_cpu(req->data_offset);
+
+		dr->domain = req->performance_domain;
+		dr->data_size = be_to_cpu(req->data_size);
+		dr->timebase_offset = group_timebase_offset(d->c, dr->domain,
+				data_offset, dr->data_size);
+		dr->first_counter = plan->counter_count;
+
+		for (j = lower_bound(d, data_offset); j < d->c->event_count; j++) {
+			struct catalog_event *ev = d->by_offset[j];
+			unsigned offset = event_offset(ev->data);
+			if (offset + 8 > data_offset + dr->data_size)
+				break;
+			if (!event_in_domain(ev, dr->domain))
+				continue;
+
+			if (plan->counter_count == alloc) {
+				alloc = alloc ? alloc * 2 : 64;
+				plan->counters = realloc(plan->counters, sizeof(*plan->counters) * alloc);
+				if (!plan->counters)
+					err(1, "alloc failure");
+			}
+
+			plan->counters[plan->counter_count++] = (struct decode_counter) {
+				.event = ev,
+				.offset = offset - data_offset,
+				.key = counter_key(dr->domain, offset),
+			};
+		}
+
+		dr->counter_count = plan->counter_count - dr->first_counter;
+		pr_debug(2, "request %zu: domain %u, %u bytes at %u, %zu events, timebase at %d",
+				i, dr->domain, dr->data_size, data_offset,
+				dr->counter_count, dr->timebase_offset);
+	}
+
+	plan->request_count = n;
+	plan->request = malloc(request_len);
+	if (!plan->request)
+		err(1, "alloc failure");
+	memcpy(plan->request, rb, request_len);
+	plan->request_len = request_len;
+
+	pr_debug(1, "decode plan %zu: %zu requests, %zu counters",
+			(size_t)(plan - d->plans), plan->request_count, plan->counter_count);
+}
+
+/*
+ * The plan for @rb, built if it isn't one of the cached ones (replacing the
+ * least recently used plan once there are DECODE_PLANS_MAX of them).
+ */
+static struct decode_plan *plan_get(struct hv_decoder *d,
+		const struct hv_24x7_request_buffer *rb, size_t request_len)
+{
+	struct decode_plan *plan;
+	size_t i;
+
+	/* calls come round in the same order, so start after the last one */
+	for (i = 1; i <= d->plan_count; i++) {
+		plan = &d->plans[(d->plan_last + i) % d->plan_count];
+		if (plan->request_len == request_len && !memcmp(plan->request, rb, request_len))
+			goto found;
+	}
+
+	if (d->plan_count < DECODE_PLANS_MAX) {
+		if (d->plan_count == d->plan_alloc) {
+			d->plan_alloc = d->plan_alloc ? d->plan_alloc * 2 : 16;
+			d->plans = realloc(d->plans, sizeof(*d->plans) * d->plan_alloc);
+			if (!d->plans)
+				err(1, "alloc failure");
+		}
+		plan = &d->plans[d->plan_count++];
+		memset(plan, 0, sizeof(*plan));
+	} else {
+		plan = &d->plans[0];
+		for (i = 1; i < d->plan_count; i++)
+			if (d->plans[i].last_used < plan->last_used)
+				plan = &d->plans[i];
+		plan_free(plan);
+	}
+	plan_build(d, plan, rb, request_len);
+
+found:
+	plan->last_used = ++d->plan_uses;
+	d->plan_last = plan - d->plans;
+	return plan;
+}
+
+/* The counter is in the high bits and the table masks the low ones: mix */
+static uint64_t hash_key(uint64_t key)
+{
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	return key ^ (key >> 31);
+}
+
+static void prev_grow(struct hv_decoder *d)
+{
+	size_t old_size = d->prev_size, i;
+	struct prev_value *old = d->prev;
+
+	d->prev_size = old_size ? old_size * 2 : 1024;
+	d->prev = calloc(d->prev_size, sizeof(*d->prev));
+	if (!d->prev)
+		err(1, "alloc failure");
+
+	for (i = 0; i < old_size; i++) {
+		if (!old[i].key)
+			continue;
+		size_t h = hash_key(old[i].key) & (d->prev_size - 1);
+		while (d->prev[h].key)
+			h = (h + 1) & (d->prev_size - 1);
+		d->prev[h] = old[i];
+	}
+
+	free(old);
+}
+
+/* Returns the slot for @key, which is empty (key == 0) if @key is new */
+static struct prev_value *prev_find(struct hv_decoder *d, uint64_t key)
+{
+	if (d->prev_used * 2 >= d->prev_size)
+		prev_grow(d);
+
+	size_t h = hash_key(key) & (d->prev_size - 1);
+	while (d->prev[h].key && d->prev[h].key != key)
+		h = (h + 1) & (d->prev_size - 1);
+	return &d->prev[h];
+}
+
+int hv_decode(struct hv_decoder *d, uint64_t timestamp_ns,
+		const void *request, size_t request_len,
+		const void *result, size_t result_len,
+		hv_sample_fn fn, void *arg)
+{
+	const struct hv_24x7_request_buffer *rb = request;
+	const struct hv_24x7_data_result_buffer *res = result;
+	const unsigned char *p, *end = (const unsigned char *)result + result_len;
+	size_t i, j, k;
+
+	if (request_len < sizeof(*rb) ||
+			request_len < sizeof(*rb) + rb->num_requests * sizeof(rb->requests[0])) {
+		warnx("request buffer too short (%zu bytes)", request_len);
+		return -1;
+	}
+
+	struct decode_plan *plan = plan_get(d, rb, request_len);
+
+	if (result_len < sizeof(*res)) {
+		warnx("result buffer too short (%zu bytes)", result_len);
+		return -1;
+	}
+
+	if (be_to_cpu(res->detailed_rc)) {
+		warnx("request %u failed, detailed_rc=0x%"PRIx32,
+				res->failing_request_ix, (uint32_t)be_to_cpu(res->detailed_rc));
+		return -1;
+	}
+
+	p = (const unsigned char *)res->results;
+	for (i = 0; i < res->num_results; i++) {
+		const struct hv_24x7_result *r = (const void *)p;
+		if ((size_t)(end - p) < sizeof(*r)) {
+			warnx("result %zu exceeds the result buffer", i);
+			return -1;
+		}
+
+		unsigned data_size = be_to_cpu(r->result_element_data_size);
+		size_t element_size = sizeof(struct hv_24x7_result_element) + data_size;
+		size_t elements = be_to_cpu(r->num_elements_returned);
+		if (r->result_ix >= plan->request_count ||
+				plan->requests[r->result_ix].data_size != data_size) {
+			warnx("result %zu does not match any request", i);
+			return -1;
+		}
+
+		p += sizeof(*r);
+		if ((size_t)(end - p) / element_size < elements) {
+			warnx("result %zu: %zu elements exceed the result buffer", i, elements);
+			return -1;
+		}
+
+		struct decode_request *dr = &plan->requests[r->result_ix];
+		for (j = 0; j < elements; j++, p += element_size) {
+			const struct hv_24x7_result_element *e = (const void *)p;
+			struct hv_sample s = {
+				.domain = dr->domain,
+				.domain_ix = be_to_cpu(e->domain_ix),
+				.lpar_ix = be_to_cpu(e->lpar_ix),
+				.timestamp_ns = timestamp_ns,
+			};
+			uint64_t now = timestamp_ns, hz = 1000000000;
+			bool is_timebase = false;
+
+			if (dr->timebase_offset >= 0) {
+				s.timebase = load_be64(e->element_data + dr->timebase_offset);
+				now = s.timebase;
+				hz = d->timebase_hz;
+				is_timebase = true;
+			}
+
+			for (k = 0; k < dr->counter_count; k++) {
+				struct decode_counter *dc = &plan->counters[dr->first_counter + k];
+
+				s.event = dc->event;
+
+				/*
+				 * Events sharing a counter are next to each other and
+				 * share its previous value too, which the first of them
+				 * has just replaced.
+				 */
+				if (k && dc->offset == dc[-1].offset) {
+					int ret = fn(arg, &s);
+					if (ret)
+						return ret;
+					continue;
+				}
+
+				uint64_t key = (dc->key | (uint64_t)s.lpar_ix << 16 | s.domain_ix) + 1;
+				struct prev_value *pv = prev_find(d, key);
+
+				s.value = load_be64(e->element_data + dc->offset);
+				s.delta = 0;
+				s.rate = 0;
+
+				if (pv->key) {
+					s.delta = s.value - pv->value;
+					/* a counter may be read with and without its group's timebase */
+					if (pv->is_timebase == is_timebase && now > pv->time)
+						s.rate = (double)s.delta * hz / (now - pv->time);
+				} else {
+					pv->key = key;
+					d->prev_used++;
+				}
+				pv->value = s.value;
+				pv->time = now;
+				pv->is_timebase = is_timebase;
+
+				int ret = fn(arg, &s);
+				if (ret)
+					return ret;
+			}
+		}
+	}
+
+	return 0;
+}
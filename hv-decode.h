@@ -0,0 +1,73 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef HV_DECODE_H_
+#define HV_DECODE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "catalog.h"
+
+/*
+ * Turn H_GET_24X7_DATA result buffers into per event counts, deltas and
+ * rates.
+ *
+ * Each request reads @data_size bytes at @data_offset of its domain; every
+ * catalog event whose counter falls in that range (and which exists in the
+ * domain) is reported for every returned element. When a request covers a
+ * whole group record, the group's schema supplies the timebase of the
+ * update, otherwise the time of the call is used for rates.
+ *
+ * Working out which events a request covers is done once per distinct
+ * request buffer (a few dozen are kept), not per result. Previous values
+ * belong to the counter (domain, offset, domain index and lpar), not to the
+ * request buffer that read it, so deltas carry across calls that split the
+ * requests differently.
+ */
+
+/* POWER7/POWER8 timebase */
+#define HV_TIMEBASE_HZ_DEFAULT 512000000
+
+struct hv_sample {
+	const struct catalog_event *event;
+	unsigned domain;
+	/* chip, core, or virtual processor, depending on @domain */
+	unsigned domain_ix;
+	unsigned lpar_ix;
+
+	uint64_t timestamp_ns;
+	/* from the group record, 0 if it has none */
+	uint64_t timebase;
+
+	uint64_t value;
+	/* since the previous result for the same counter, 0 for the first */
+	uint64_t delta;
+	/* per second */
+	double rate;
+};
+
+/* A non-zero return stops decoding and is returned by hv_decode() */
+typedef int (*hv_sample_fn)(void *arg, const struct hv_sample *s);
+
+struct hv_decoder;
+
+/* @c must outlive the decoder */
+struct hv_decoder *hv_decoder_new(struct catalog *c, uint64_t timebase_hz);
+void hv_decoder_free(struct hv_decoder *d);
+
+/* Forget previous values, so the next results have no deltas */
+void hv_decoder_reset(struct hv_decoder *d);
+
+/* Returns 0, -1 if either buffer is malformed, or @fn's non-zero return */
+int hv_decode(struct hv_decoder *d, uint64_t timestamp_ns,
+		const void *request, size_t request_len,
+		const void *result, size_t result_len,
+		hv_sample_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,377 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/err/err.h>
+
+#include "pmu-format.h"
+#include "pmu-aliases.h"
+
+/* sysfs attributes are at most a page, our snapshots pad them to 64k */
+#define ALIAS_READ_MAX 4096
+#define ALIAS_TERMS_MAX 8
+/* for the offsets kept while @strings may still move */
+#define NO_STRING SIZE_MAX
+
+static const char *const alias_terms[] = {
+	"domain",
+	"offset",
+	"starting_index",
+	"lpar",
+};
+
+struct alias_strings {
+	size_t name, starting_index, lpar;
+};
+
+static size_t string_add(struct pmu_aliases *a, const char *s, size_t len)
+{
+	size_t off = a->strings_len;
+	if (off + len + 1 > a->strings_alloc) {
+		size_t n = a->strings_alloc ? a->strings_alloc * 2 : 65536;
+		while (n < off + len + 1)
+			n *= 2;
+		a->strings = realloc(a->strings, n);
+		if (!a->strings)
+			err(1, "alloc failure");
+		a->strings_alloc = n;
+	}
+
+	memcpy(a->strings + off, s, len);
+	a->strings[off + len] = '\0';
+	a->strings_len += len + 1;
+	return off;
+}
+
+/* Fills in everything but the name, returns false if @buf isn't an alias */
+static bool alias_parse(struct pmu_aliases *a, const char *file,
+		const char *buf, size_t len, struct pmu_alias *al,
+		struct alias_strings *s)
+{
+	struct pmu_term terms[ALIAS_TERMS_MAX];
+	unsigned seen = 0;
+	int n, i;
+
+	/* padding may fill the rest of the page, the alias itself may not */
+	size_t l = strnlen(buf, len);
+	while (l && isspace((unsigned char)buf[l - 1]))
+		l--;
+	if (l == ALIAS_READ_MAX) {
+		warnx("%s: alias is longer than %d bytes", file, ALIAS_READ_MAX);
+		return false;
+	}
+
+	n = pmu_alias_parse(buf, len, terms, ARRAY_SIZE(terms));
+	if (n < 0 || n > (int)ARRAY_SIZE(terms)) {
+		warnx("%s: could not parse alias", file);
+		return false;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct pmu_term *t = &terms[i];
+		unsigned j;
+
+		for (j = 0; j < ARRAY_SIZE(alias_terms); j++)
+			if (strlen(alias_terms[j]) == t->name_len &&
+					!memcmp(alias_terms[j], t->name, t->name_len))
+				break;
+		if (j == ARRAY_SIZE(alias_terms)) {
+			warnx("%s: unknown term \"%.*s\"", file, (int)t->name_len, t->name);
+			return false;
+		}
+		if (seen & (1u << j)) {
+			warnx("%s: %s is given twice", file, alias_terms[j]);
+			return false;
+		}
+		seen |= 1u << j;
+
+		/* the domain and offset are fixed for each alias */
+		if (j < 2 && t->param) {
+			warnx("%s: %s is \"%.*s\", not a number", file, alias_terms[j],
+					(int)t->param_len, t->param);
+			return false;
+		}
+
+		switch (j) {
+		case 0:
+			al->domain = t->value;
+			if (al->domain != t->value) {
+				warnx("%s: domain 0x%"PRIx64" is out of range", file, t->value);
+				return false;
+			}
+			break;
+		case 1:
+			al->offset = t->value;
+			break;
+		case 2:
+			al->starting_index.value = t->value;
+			al->starting_index.param_len = t->param_len;
+			if (t->param)
+				s->starting_index = string_add(a, t->param, t->param_len);
+			break;
+		case 3:
+			al->lpar.value = t->value;
+			al->lpar.param_len = t->param_len;
+			if (t->param)
+				s->lpar = string_add(a, t->param, t->param_len);
+			break;
+		}
+	}
+
+	if (seen != (1u << ARRAY_SIZE(alias_terms)) - 1) {
+		warnx("%s: missing one of domain, offset, starting_index or lpar", file);
+		return false;
+	}
+
+	return true;
+}
+
+static int alias_cmp(const void *a_, const void *b_)
+{
+	const struct pmu_alias *a = a_, *b = b_;
+	int r = memcmp(a->name, b->name, a->name_len < b->name_len ? a->name_len : b->name_len);
+	if (r)
+		return r;
+	return (a->name_len > b->name_len) - (a->name_len < b->name_len);
+}
+
+int pmu_aliases_read(struct pmu_aliases *a, const char *events_dir)
+{
+	struct alias_strings *strings = NULL;
+	char buf[ALIAS_READ_MAX];
+	size_t alloc = 0, i;
+	struct dirent *de;
+
+	memset(a, 0, sizeof(*a));
+
+	int dfd = open(events_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd == -1) {
+		warn("could not open %s", events_dir);
+		return -1;
+	}
+
+	DIR *d = fdopendir(dfd);
+	if (!d) {
+		warn("could not open %s", events_dir);
+		close(dfd);
+		return -1;
+	}
+
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		int fd = openat(dfd, de->d_name, O_RDONLY | O_CLOEXEC);
+		if (fd == -1) {
+			warn("could not open %s/%s", events_dir, de->d_name);
+			a->bad++;
+			continue;
+		}
+
+		/*
+		 * sysfs hands over the whole attribute in the first read, so
+		 * stop at its end instead of reading again to see EOF.
+		 */
+		size_t len = 0;
+		ssize_t r = 0;
+		while (len < sizeof(buf) && (r = read(fd, buf + len, sizeof(buf) - len)) > 0) {
+			len += r;
+			if (memchr(buf + len - r, '\n', r) || memchr(buf + len - r, '\0', r))
+				break;
+		}
+		close(fd);
+		if (r < 0) {
+			warn("could not read %s/%s", events_dir, de->d_name);
+			a->bad++;
+			continue;
+		}
+
+		if (a->count == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			a->aliases = realloc(a->aliases, alloc * sizeof(*a->aliases));
+			strings = realloc(strings, alloc * sizeof(*strings));
+			if (!a->aliases || !strings)
+				err(1, "alloc failure");
+		}
+
+		struct pmu_alias *al = &a->aliases[a->count];
+		struct alias_strings *s = &strings[a->count];
+		memset(al, 0, sizeof(*al));
+		s->starting_index = s->lpar = NO_STRING;
+
+		if (!alias_parse(a, de->d_name, buf, len, al, s)) {
+			a->bad++;
+			continue;
+		}
+
+		al->name_len = strlen(de->d_name);
+		s->name = string_add(a, de->d_name, al->name_len);
+		a->count++;
+	}
+
+	closedir(d);
+
+	/* @strings is done growing */
+	for (i = 0; i < a->count; i++) {
+		struct pmu_alias *al = &a->aliases[i];
+		al->name = a->strings + strings[i].name;
+		if (strings[i].starting_index != NO_STRING)
+			al->starting_index.param = a->strings + strings[i].starting_index;
+		if (strings[i].lpar != NO_STRING)
+			al->lpar.param = a->strings + strings[i].lpar;
+	}
+	free(strings);
+
+	qsort(a->aliases, a->count, sizeof(*a->aliases), alias_cmp);
+	pr_debug(1, "%zu aliases, %zu bad, %zu bytes of strings", a->count, a->bad, a->strings_len);
+	return 0;
+}
+
+void pmu_aliases_free(struct pmu_aliases *a)
+{
+	free(a->aliases);
+	free(a->strings);
+	memset(a, 0, sizeof(*a));
+}
+
+struct pmu_alias *pmu_aliases_find(struct pmu_aliases *a, const char *name, size_t name_len)
+{
+	struct pmu_alias key = {
+		.name = name,
+		.name_len = name_len,
+	};
+	return bsearch(&key, a->aliases, a->count, sizeof(*a->aliases), alias_cmp);
+}
+
+static bool value_is(const struct pmu_alias_value *v, const char *param)
+{
+	return v->param && v->param_len == strlen(param) &&
+		!memcmp(v->param, param, v->param_len);
+}
+
+static void print_value(FILE *o, const struct pmu_alias_value *v)
+{
+	if (v->param)
+		fprintf(o, "%.*s", (int)v->param_len, v->param);
+	else
+		fprintf(o, "0x%"PRIx64, v->value);
+}
+
+static void print_alias(FILE *o, const struct pmu_alias *al)
+{
+	fprintf(o, "domain=0x%x,offset=0x%"PRIx64",starting_index=", al->domain, al->offset);
+	print_value(o, &al->starting_index);
+	fprintf(o, ",lpar=");
+	print_value(o, &al->lpar);
+}
+
+size_t pmu_aliases_check(struct pmu_aliases *a, struct catalog *c, FILE *o,
+		struct pmu_aliases_check *st)
+{
+	bool *seen = calloc(a->count ? a->count : 1, sizeof(*seen));
+	char *name = NULL;
+	size_t name_alloc = 0, i, j;
+
+	if (!seen)
+		err(1, "alloc failure");
+	memset(st, 0, sizeof(*st));
+
+	for (i = 0; i < c->event_count; i++) {
+		struct hv_24x7_event_data *ev = c->events[i].data;
+		unsigned domains[CATALOG_EVENT_DOMAINS_MAX];
+		size_t domain_count = event_domains(ev, domains), nl;
+		const char *en = event_name(ev, &nl);
+
+		nl = catalog_name_trim(en, nl);
+		for (j = 0; j < domain_count; j++) {
+			const char *suffix = domain_alias_suffix(domains[j]);
+			const char *ix = domain_to_index_string(domains[j]);
+			bool physical = is_physical_domain(domains[j]);
+
+			/* catalog names may be up to 64k long */
+			size_t len = nl + (suffix ? 2 + strlen(suffix) : 0);
+			if (len + 1 > name_alloc) {
+				name_alloc = len + 1;
+				name = realloc(name, name_alloc);
+				if (!name)
+					err(1, "alloc failure");
+			}
+			memcpy(name, en, nl);
+			if (suffix) {
+				memcpy(name + nl, "__", 2);
+				memcpy(name + nl + 2, suffix, strlen(suffix));
+			}
+			name[len] = '\0';
+
+			struct pmu_alias want = {
+				.name = name,
+				.name_len = len,
+				.domain = domains[j],
+				.offset = event_offset(ev),
+				.starting_index = { .param = ix, .param_len = strlen(ix) },
+				.lpar = physical ? (struct pmu_alias_value) { .value = 0 } :
+					(struct pmu_alias_value) { .param = "sibling_guest_id",
+						.param_len = strlen("sibling_guest_id") },
+			};
+
+			st->expected++;
+			struct pmu_alias *have = pmu_aliases_find(a, name, len);
+			if (!have) {
+				st->missing++;
+				if (o) {
+					fprintf(o, "missing %s: ", name);
+					print_alias(o, &want);
+					fputc('\n', o);
+				}
+				continue;
+			}
+
+			seen[have - a->aliases] = true;
+			if (have->domain == want.domain && have->offset == want.offset &&
+					value_is(&have->starting_index, ix) &&
+					(physical || value_is(&have->lpar, "sibling_guest_id")))
+				continue;
+
+			st->mismatched++;
+			if (o) {
+				fprintf(o, "mismatched %s: ", name);
+				print_alias(o, have);
+				fprintf(o, ", expected ");
+				print_alias(o, &want);
+				fputc('\n', o);
+			}
+		}
+	}
+
+	for (i = 0; i < a->count; i++) {
+		if (seen[i])
+			continue;
+		st->extra++;
+		if (o) {
+			fprintf(o, "extra %.*s: ", (int)a->aliases[i].name_len, a->aliases[i].name);
+			print_alias(o, &a->aliases[i]);
+			fputc('\n', o);
+		}
+	}
+
+	free(name);
+	free(seen);
+	return st->missing + st->extra + st->mismatched;
+}
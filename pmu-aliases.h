@@ -0,0 +1,81 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef PMU_ALIASES_H_
+#define PMU_ALIASES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "catalog.h"
+
+/*
+ * The aliases the kernel lists in hv_24x7/events/, one file per alias,
+ * each holding "domain=0x2,offset=0xe0,starting_index=core,lpar=0x0".
+ */
+
+/* A term given as a number has a NULL @param */
+struct pmu_alias_value {
+	const char *param;
+	size_t param_len;
+	uint64_t value;
+};
+
+struct pmu_alias {
+	const char *name;
+	size_t name_len;
+	unsigned domain;
+	uint64_t offset;
+	struct pmu_alias_value starting_index;
+	struct pmu_alias_value lpar;
+};
+
+struct pmu_aliases {
+	/* sorted by name */
+	struct pmu_alias *aliases;
+	size_t count;
+	/* files that could not be read or parsed, or missing a term */
+	size_t bad;
+
+	/* names and params of every alias */
+	char *strings;
+	size_t strings_len, strings_alloc;
+};
+
+/*
+ * Read every alias in @events_dir. Files are opened relative to the
+ * directory and read (only as far as the first page) into one buffer.
+ * Unreadable or malformed files are warned about and counted in @bad.
+ */
+int pmu_aliases_read(struct pmu_aliases *a, const char *events_dir);
+void pmu_aliases_free(struct pmu_aliases *a);
+
+/* Returns NULL if there is no alias named @name */
+struct pmu_alias *pmu_aliases_find(struct pmu_aliases *a, const char *name, size_t name_len);
+
+struct pmu_aliases_check {
+	/* aliases the catalog says should exist */
+	size_t expected;
+	/* expected, but not there */
+	size_t missing;
+	/* there, but not for any event in the catalog */
+	size_t extra;
+	/* there, but with a different domain, offset, index or lpar */
+	size_t mismatched;
+};
+
+/*
+ * Compare the aliases with the events of @c, printing each problem to @o
+ * (if not NULL). The lpar of physical domain aliases is ignored, as the
+ * hypervisor does. Returns the number of problems.
+ */
+size_t pmu_aliases_check(struct pmu_aliases *a, struct catalog *c, FILE *o,
+		struct pmu_aliases_check *st);
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/*
+ * Compile a pmu's format/ directory into an encoder and use it to turn
+ * events into ready to use perf_event_attr config values, either for every
+ * event (in every domain) in a catalog or for every alias in the pmu's
+ * events/ directory.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/err/err.h>
+
+#include "catalog.h"
+#include "pmu-format.h"
+
+struct param {
+	const char *name;
+	size_t name_len;
+	uint64_t value;
+};
+
+static struct param *params;
+static size_t param_count;
+
+/* Parameters ("core", "sibling_guest_id", ...) that aren't given are 0 */
+static uint64_t param_value(const char *name, size_t name_len)
+{
+	size_t i;
+	for (i = 0; i < param_count; i++)
+		if (params[i].name_len == name_len &&
+				!memcmp(params[i].name, name, name_len))
+			return params[i].value;
+	return 0;
+}
+
+static void add_param(const char *arg)
+{
+	const char *eq = strchr(arg, '=');
+	char *end;
+	if (!eq || eq == arg)
+		errx(1, "parameters are given as name=value, got \"%s\"", arg);
+
+	params = realloc(params, sizeof(*params) * (param_count + 1));
+	if (!params)
+		err(1, "alloc failure");
+
+	struct param *p = &params[param_count++];
+	p->name = arg;
+	p->name_len = eq - arg;
+	p->value = strtoull(eq + 1, &end, 0);
+	if (*end || end == eq + 1)
+		errx(1, "invalid parameter value \"%s\"", eq + 1);
+}
+
+static void print_config(FILE *o, const char *name, size_t name_len,
+		const char *suffix, const struct pmu_config *c)
+{
+	fprintf(o, "%.*s%s%s\tconfig=0x%"PRIx64",config1=0x%"PRIx64,
+			(int)name_len, name, suffix ? "__" : "", suffix ? suffix : "",
+			c->config[0], c->config[1]);
+	if (c->config[2])
+		fprintf(o, ",config2=0x%"PRIx64, c->config[2]);
+	fputc('\n', o);
+}
+
+static const char *const catalog_fields[] = {
+	"domain",
+	"offset",
+	"starting_index",
+	"lpar",
+};
+
+static int encode_catalog(const struct pmu_format *f, const char *file)
+{
+	struct pmu_encoder e;
+	struct catalog c;
+	size_t i, j, n = 0;
+	int ret = 1;
+
+	if (pmu_encoder_compile(&e, f, catalog_fields, ARRAY_SIZE(catalog_fields)))
+		return 1;
+
+	if (catalog_load(&c, file))
+		goto out_encoder;
+
+	size_t max = c.event_count * CATALOG_EVENT_DOMAINS_MAX;
+	uint64_t *args = malloc(sizeof(*args) * max * e.arg_count);
+	struct pmu_config *configs = malloc(sizeof(*configs) * max);
+	struct {
+		struct hv_24x7_event_data *ev;
+		unsigned domain;
+	} *which = malloc(sizeof(*which) * max);
+	if (!args || !configs || !which)
+		err(1, "alloc failure");
+
+	for (i = 0; i < c.event_count; i++) {
+		struct hv_24x7_event_data *ev = c.events[i].data;
+		unsigned domains[CATALOG_EVENT_DOMAINS_MAX];
+		size_t domain_count = event_domains(ev, domains);
+
+		for (j = 0; j < domain_count; j++) {
+			const char *ix = domain_to_index_string(domains[j]);
+			uint64_t *a = &args[n * e.arg_count];
+
+			a[0] = domains[j];
+			a[1] = event_offset(ev);
+			a[2] = param_value(ix, strlen(ix));
+			a[3] = is_physical_domain(domains[j]) ? 0 :
+				param_value("sibling_guest_id", strlen("sibling_guest_id"));
+
+			which[n].ev = ev;
+			which[n].domain = domains[j];
+			n++;
+		}
+	}
+
+	size_t bad = pmu_encode_bulk(&e, args, n, configs);
+	if (bad)
+		warnx("%zu events had values which don't fit in their fields", bad);
+
+	for (i = 0; i < n; i++) {
+		size_t nl;
+		char *name = event_name(which[i].ev, &nl);
+		print_config(stdout, name, nl, domain_alias_suffix(which[i].domain), &configs[i]);
+	}
+
+	ret = !!bad;
+	free(which);
+	free(configs);
+	free(args);
+	catalog_free(&c);
+out_encoder:
+	pmu_encoder_free(&e);
+	return ret;
+}
+
+#define TERMS_MAX 16
+
+static int encode_aliases(const struct pmu_format *f, const char *pmu_dir)
+{
+	const char *names[TERMS_MAX];
+	struct pmu_encoder e;
+	struct pmu_config config;
+	uint64_t args[TERMS_MAX];
+	char path[PATH_MAX];
+	char buf[4096];
+	struct dirent *de;
+	size_t i;
+	int ret = 0;
+
+	/* one encoder argument per format field, in format order */
+	if (f->field_count > TERMS_MAX)
+		errx(1, "too many format fields (%zu)", f->field_count);
+	for (i = 0; i < f->field_count; i++)
+		names[i] = f->fields[i].name;
+	if (pmu_encoder_compile(&e, f, names, f->field_count))
+		return 1;
+
+	snprintf(path, sizeof(path), "%s/events", pmu_dir);
+	DIR *d = opendir(path);
+	if (!d) {
+		warn("could not open %s", path);
+		pmu_encoder_free(&e);
+		return 1;
+	}
+
+	while ((de = readdir(d))) {
+		struct pmu_term terms[TERMS_MAX];
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), "%s/events/%s", pmu_dir, de->d_name);
+		FILE *fp = fopen(path, "r");
+		if (!fp) {
+			warn("could not open %s", path);
+			ret = 1;
+			continue;
+		}
+		size_t r = fread(buf, 1, sizeof(buf), fp);
+		fclose(fp);
+
+		int n = pmu_alias_parse(buf, r, terms, ARRAY_SIZE(terms));
+		if (n < 0 || n > TERMS_MAX) {
+			warnx("%s: could not parse alias", de->d_name);
+			ret = 1;
+			continue;
+		}
+
+		memset(args, 0, sizeof(args));
+		for (i = 0; i < (size_t)n; i++) {
+			struct pmu_term *t = &terms[i];
+			int fix = pmu_format_field_ix(f, t->name, t->name_len);
+			if (fix < 0) {
+				warnx("%s: unknown term \"%.*s\"", de->d_name,
+						(int)t->name_len, t->name);
+				ret = 1;
+				continue;
+			}
+			args[fix] = t->param ? param_value(t->param, t->param_len) : t->value;
+		}
+
+		if (!pmu_encode(&e, args, &config)) {
+			warnx("%s: value too large for its field", de->d_name);
+			ret = 1;
+		}
+		print_config(stdout, de->d_name, strlen(de->d_name), NULL, &config);
+	}
+
+	closedir(d);
+	pmu_encoder_free(&e);
+	return ret;
+}
+
+static void _usage(const char *p, int e)
+{
+	FILE *o = stderr;
+	fprintf(o,
+"usage: %s [-p param=value]... <pmu sysfs dir> [<catalog file>]\n"
+"\n"
+"Encode every event in <catalog file> (or, without one, every alias in\n"
+"<pmu sysfs dir>/events/) using the layout in <pmu sysfs dir>/format/.\n"
+"Parameters (ex: core, vcpu, sibling_guest_id) default to 0.\n", p);
+	exit(e);
+}
+
+#define _PRGM_NAME "pmu-encode"
+#define PRGM_NAME  (argc?argv[0]:_PRGM_NAME)
+#define usage(argc, argv, e) _usage(PRGM_NAME, e)
+#define U(e) usage(argc, argv, e)
+
+int main(int argc, char **argv)
+{
+	struct pmu_format f;
+	int opt, ret;
+
+	err_set_progname(PRGM_NAME);
+
+	while ((opt = getopt(argc, argv, "p:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			add_param(optarg);
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (argc - optind < 1 || argc - optind > 2)
+		U(1);
+
+	if (pmu_format_read(&f, argv[optind]))
+		return 1;
+
+	if (argc - optind == 2)
+		ret = encode_catalog(&f, argv[optind + 1]);
+	else
+		ret = encode_aliases(&f, argv[optind]);
+
+	pmu_format_free(&f);
+	free(params);
+	return ret;
+}
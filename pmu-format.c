@@ -0,0 +1,334 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
+#include <dirent.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+
+#include "pmu-format.h"
+
+void pmu_format_init(struct pmu_format *f)
+{
+	memset(f, 0, sizeof(*f));
+	f->type = -1;
+}
+
+void pmu_format_free(struct pmu_format *f)
+{
+	size_t i;
+	for (i = 0; i < f->field_count; i++)
+		free(f->fields[i].name);
+	free(f->fields);
+	pmu_format_init(f);
+}
+
+/* Sysfs attributes are newline terminated (and in our snapshots, '\0' padded) */
+static size_t attr_len(const char *s, size_t len)
+{
+	size_t l = strnlen(s, len);
+	while (l && isspace((unsigned char)s[l - 1]))
+		l--;
+	return l;
+}
+
+/* Parses a decimal number at *p, advancing it. Returns -1 if none is there */
+static int parse_bit(const char **p, const char *end)
+{
+	int v = 0;
+	if (*p >= end || !isdigit((unsigned char)**p))
+		return -1;
+	while (*p < end && isdigit((unsigned char)**p)) {
+		v = v * 10 + (**p - '0');
+		if (v > 63)
+			return -1;
+		(*p)++;
+	}
+	return v;
+}
+
+int pmu_format_add(struct pmu_format *f, const char *name, const char *spec, size_t spec_len)
+{
+	struct pmu_format_field field = { .range_count = 0 };
+	const char *p = spec, *end = spec + attr_len(spec, spec_len);
+	size_t wl;
+
+	for (wl = 0; p + wl < end && p[wl] != ':'; wl++)
+		;
+
+	if (wl == 6 && !memcmp(p, "config", 6))
+		field.ranges[0].word = 0;
+	else if (wl == 7 && !memcmp(p, "config1", 7))
+		field.ranges[0].word = 1;
+	else if (wl == 7 && !memcmp(p, "config2", 7))
+		field.ranges[0].word = 2;
+	else
+		goto bad;
+
+	p += wl;
+	if (p >= end)
+		goto bad;
+	p++;
+
+	for (;;) {
+		struct pmu_format_range *r;
+		int lo, hi;
+
+		if (field.range_count == PMU_FORMAT_RANGES_MAX)
+			goto bad;
+		r = &field.ranges[field.range_count];
+		r->word = field.ranges[0].word;
+
+		lo = parse_bit(&p, end);
+		if (lo < 0)
+			goto bad;
+		hi = lo;
+		if (p < end && *p == '-') {
+			p++;
+			hi = parse_bit(&p, end);
+			if (hi < lo)
+				goto bad;
+		}
+
+		r->lo = lo;
+		r->hi = hi;
+		field.range_count++;
+
+		if (p == end)
+			break;
+		if (*p != ',')
+			goto bad;
+		p++;
+	}
+
+	field.name = strdup(name);
+	struct pmu_format_field *n = realloc(f->fields, sizeof(*f->fields) * (f->field_count + 1));
+	if (!field.name || !n) {
+		free(field.name);
+		warnx("alloc failure");
+		return -1;
+	}
+
+	f->fields = n;
+	f->fields[f->field_count++] = field;
+	return 0;
+
+bad:
+	warnx("format %s: could not parse \"%.*s\"", name, (int)(end - spec), spec);
+	return -1;
+}
+
+static int field_cmp(const void *a_, const void *b_)
+{
+	const struct pmu_format_field *a = a_, *b = b_;
+	return strcmp(a->name, b->name);
+}
+
+int pmu_format_read(struct pmu_format *f, const char *pmu_dir)
+{
+	char path[PATH_MAX];
+	char buf[256];
+	struct dirent *de;
+	FILE *fp;
+	size_t r;
+
+	pmu_format_init(f);
+
+	snprintf(path, sizeof(path), "%s/type", pmu_dir);
+	fp = fopen(path, "r");
+	if (fp) {
+		r = fread(buf, 1, sizeof(buf) - 1, fp);
+		buf[r] = '\0';
+		f->type = strtol(buf, NULL, 0);
+		fclose(fp);
+	}
+
+	snprintf(path, sizeof(path), "%s/format", pmu_dir);
+	DIR *d = opendir(path);
+	if (!d) {
+		warn("could not open %s", path);
+		return -1;
+	}
+
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), "%s/format/%s", pmu_dir, de->d_name);
+		fp = fopen(path, "r");
+		if (!fp) {
+			warn("could not open %s", path);
+			goto err;
+		}
+
+		r = fread(buf, 1, sizeof(buf), fp);
+		fclose(fp);
+
+		if (pmu_format_add(f, de->d_name, buf, r))
+			goto err;
+	}
+	closedir(d);
+
+	qsort(f->fields, f->field_count, sizeof(*f->fields), field_cmp);
+	return 0;
+
+err:
+	closedir(d);
+	pmu_format_free(f);
+	return -1;
+}
+
+int pmu_format_field_ix(const struct pmu_format *f, const char *name, size_t name_len)
+{
+	size_t i;
+	for (i = 0; i < f->field_count; i++)
+		if (!strncmp(f->fields[i].name, name, name_len) &&
+				!f->fields[i].name[name_len])
+			return i;
+	return -1;
+}
+
+static uint64_t bits(unsigned n)
+{
+	return n >= 64 ? ~0ULL : (1ULL << n) - 1;
+}
+
+int pmu_encoder_compile(struct pmu_encoder *e, const struct pmu_format *f,
+		const char *const *names, size_t name_count)
+{
+	size_t i, j;
+
+	memset(e, 0, sizeof(*e));
+	e->arg_count = name_count;
+	e->overflow_mask = calloc(name_count, sizeof(*e->overflow_mask));
+	e->ops = calloc(name_count * PMU_FORMAT_RANGES_MAX, sizeof(*e->ops));
+	if ((!e->ops || !e->overflow_mask) && name_count) {
+		warnx("alloc failure");
+		goto err;
+	}
+
+	for (i = 0; i < name_count; i++) {
+		int fix = pmu_format_field_ix(f, names[i], strlen(names[i]));
+		if (fix < 0) {
+			warnx("pmu has no format field \"%s\"", names[i]);
+			goto err;
+		}
+
+		const struct pmu_format_field *field = &f->fields[fix];
+		unsigned width = 0;
+		for (j = 0; j < field->range_count; j++) {
+			const struct pmu_format_range *r = &field->ranges[j];
+			unsigned len = r->hi - r->lo + 1;
+			struct pmu_encode_op *op = &e->ops[e->op_count++];
+
+			op->arg = i;
+			op->word = r->word;
+			op->dst_shift = r->lo;
+			op->src_shift = width;
+			op->mask = bits(len);
+			width += len;
+		}
+
+		e->overflow_mask[i] = ~bits(width);
+		pr_debug(5, "encoder: arg %zu = %s, %u bits in %u ranges",
+				i, names[i], width, field->range_count);
+	}
+
+	return 0;
+
+err:
+	pmu_encoder_free(e);
+	return -1;
+}
+
+void pmu_encoder_free(struct pmu_encoder *e)
+{
+	free(e->ops);
+	free(e->overflow_mask);
+	memset(e, 0, sizeof(*e));
+}
+
+size_t pmu_encode_bulk(const struct pmu_encoder *e, const uint64_t *args, size_t n,
+		struct pmu_config *out)
+{
+	size_t i, bad = 0;
+	for (i = 0; i < n; i++)
+		bad += !pmu_encode(e, args + i * e->arg_count, &out[i]);
+	return bad;
+}
+
+void pmu_config_to_attr(const struct pmu_format *f, const struct pmu_config *c,
+		struct perf_event_attr *attr)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->size = sizeof(*attr);
+	attr->type = f->type;
+	attr->config = c->config[0];
+	attr->config1 = c->config[1];
+	attr->config2 = c->config[2];
+}
+
+static bool parse_u64(const char *s, size_t len, uint64_t *v)
+{
+	char buf[32];
+	char *end;
+
+	if (!len || len >= sizeof(buf) || !isdigit((unsigned char)s[0]))
+		return false;
+
+	memcpy(buf, s, len);
+	buf[len] = '\0';
+	*v = strtoull(buf, &end, 0);
+	return *end == '\0';
+}
+
+int pmu_alias_parse(const char *s, size_t len, struct pmu_term *terms, size_t max)
+{
+	const char *p = s, *end = s + attr_len(s, len);
+	int n = 0;
+
+	while (p < end) {
+		const char *term_end = memchr(p, ',', end - p);
+		if (!term_end)
+			term_end = end;
+
+		const char *eq = memchr(p, '=', term_end - p);
+		if (eq == p || term_end == p || eq + 1 == term_end) {
+			warnx("empty term in \"%.*s\"", (int)(end - s), s);
+			return -1;
+		}
+
+		if ((size_t)n < max) {
+			struct pmu_term *t = &terms[n];
+			memset(t, 0, sizeof(*t));
+			t->name = p;
+			if (!eq) {
+				/* a bare term is a flag */
+				t->name_len = term_end - p;
+				t->value = 1;
+			} else {
+				t->name_len = eq - p;
+				if (!parse_u64(eq + 1, term_end - eq - 1, &t->value)) {
+					t->param = eq + 1;
+					t->param_len = term_end - eq - 1;
+				}
+			}
+		}
+
+		n++;
+		p = term_end + (term_end < end);
+	}
+
+	return n;
+}
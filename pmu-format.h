@@ -0,0 +1,139 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef PMU_FORMAT_H_
+#define PMU_FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <linux/perf_event.h>
+
+/*
+ * A pmu's format/ directory describes how named fields are packed into
+ * perf_event_attr.config{,1,2}. Each file holds a spec like "config:0-3",
+ * "config1:5" or "config:0-7,32-35" (a field split over several ranges, low
+ * bits first).
+ */
+
+#define PMU_CONFIG_WORDS 3
+#define PMU_FORMAT_RANGES_MAX 4
+
+struct pmu_format_range {
+	uint8_t word; /* 0 = config, 1 = config1, 2 = config2 */
+	uint8_t lo, hi; /* inclusive bit numbers */
+};
+
+struct pmu_format_field {
+	char *name;
+	unsigned range_count;
+	struct pmu_format_range ranges[PMU_FORMAT_RANGES_MAX];
+};
+
+struct pmu_format {
+	/* value of the pmu's 'type' file, or -1 if unknown */
+	int type;
+
+	struct pmu_format_field *fields;
+	size_t field_count;
+};
+
+struct pmu_config {
+	uint64_t config[PMU_CONFIG_WORDS];
+};
+
+void pmu_format_init(struct pmu_format *f);
+void pmu_format_free(struct pmu_format *f);
+
+/* Add a single field given its spec ("config:0-3") */
+int pmu_format_add(struct pmu_format *f, const char *name, const char *spec, size_t spec_len);
+
+/* Read '<pmu_dir>/format/' (and '<pmu_dir>/type') */
+int pmu_format_read(struct pmu_format *f, const char *pmu_dir);
+
+/* Returns -1 if there is no field named @name */
+int pmu_format_field_ix(const struct pmu_format *f, const char *name, size_t name_len);
+
+/*
+ * An encoder is a format compiled for a fixed, ordered list of fields: each
+ * encode takes exactly one value per field, in that order, and is a short
+ * run of shift/mask/or steps with no name lookups or string handling.
+ */
+struct pmu_encode_op {
+	uint8_t arg;
+	uint8_t word;
+	uint8_t dst_shift;
+	uint8_t src_shift;
+	uint64_t mask;
+};
+
+struct pmu_encoder {
+	size_t arg_count;
+	/* bits above each field's width, used to reject values which don't fit */
+	uint64_t *overflow_mask;
+
+	struct pmu_encode_op *ops;
+	size_t op_count;
+};
+
+int pmu_encoder_compile(struct pmu_encoder *e, const struct pmu_format *f,
+		const char *const *names, size_t name_count);
+void pmu_encoder_free(struct pmu_encoder *e);
+
+/* Returns false if any value in @args is too wide for its field */
+static inline bool pmu_encode(const struct pmu_encoder *e, const uint64_t *args,
+		struct pmu_config *out)
+{
+	uint64_t overflow = 0;
+	size_t i;
+
+	for (i = 0; i < PMU_CONFIG_WORDS; i++)
+		out->config[i] = 0;
+
+	for (i = 0; i < e->arg_count; i++)
+		overflow |= args[i] & e->overflow_mask[i];
+
+	for (i = 0; i < e->op_count; i++) {
+		const struct pmu_encode_op *op = &e->ops[i];
+		out->config[op->word] |=
+			((args[op->arg] >> op->src_shift) & op->mask) << op->dst_shift;
+	}
+
+	return !overflow;
+}
+
+/*
+ * Encode @n events, @args holds @n * e->arg_count values. Returns the number
+ * of events which had a value too wide for its field (those are still
+ * encoded, with the excess bits dropped).
+ */
+size_t pmu_encode_bulk(const struct pmu_encoder *e, const uint64_t *args, size_t n,
+		struct pmu_config *out);
+
+void pmu_config_to_attr(const struct pmu_format *f, const struct pmu_config *c,
+		struct perf_event_attr *attr);
+
+/*
+ * Event aliases (the contents of files in a pmu's events/ directory, or the
+ * part of a perf event spec between the '/'s) are "term=value,term=value".
+ * A value that isn't a number is a parameter the user must supply (perf's
+ * "term=?"), in which case @param is set instead of @value.
+ */
+struct pmu_term {
+	const char *name;
+	size_t name_len;
+	const char *param;
+	size_t param_len;
+	uint64_t value;
+};
+
+/* Returns the number of terms found (which may exceed @max), or -1 on error */
+int pmu_alias_parse(const char *s, size_t len, struct pmu_term *terms, size_t max);
+
+#endif
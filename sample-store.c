@@ -0,0 +1,536 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+#include <ccan/endian/endian.h>
+
+#include "sample-store.h"
+
+/* LEB128, at most 10 bytes for a u64 */
+#define VARINT_MAX 10
+
+static size_t varint_put(unsigned char *p, uint64_t v)
+{
+	size_t n = 0;
+	while (v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+/* Returns the number of bytes consumed, 0 if the varint runs past @end */
+static size_t varint_get(const unsigned char *p, const unsigned char *end, uint64_t *v)
+{
+	uint64_t r = 0;
+	unsigned shift = 0;
+	size_t n = 0;
+
+	while (p + n < end && shift < 64) {
+		unsigned char b = p[n++];
+		r |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*v = r;
+			return n;
+		}
+		shift += 7;
+	}
+
+	return 0;
+}
+
+/* Counters may reset, so deltas are signed */
+static uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static size_t data_start(size_t column_count, size_t block_size)
+{
+	size_t l = sizeof(struct sample_file_header) +
+		column_count * sizeof(struct sample_file_column);
+	/* block_size is a power of 2 */
+	return (l + block_size - 1) & ~(block_size - 1);
+}
+
+static size_t block_header_len(size_t column_count)
+{
+	return sizeof(struct sample_block_header) +
+		(column_count + 1) * sizeof(struct sample_block_column);
+}
+
+struct sample_writer {
+	int fd;
+	size_t block_size;
+	size_t column_count;
+
+	/* per column, timebase first */
+	unsigned char **data;
+	size_t *len;
+	uint64_t *prev, *min, *max;
+
+	size_t data_len;
+	uint32_t rows;
+
+	unsigned char *block;
+};
+
+static void column_to_file(const struct sample_column *c, struct sample_file_column *fc)
+{
+	memset(fc, 0, sizeof(*fc));
+	fc->offset = cpu_to_le32(c->offset);
+	fc->starting_index = cpu_to_le16(c->starting_index);
+	fc->lpar = cpu_to_le16(c->lpar);
+	fc->domain = c->domain;
+}
+
+static void column_from_file(const struct sample_file_column *fc, struct sample_column *c)
+{
+	c->offset = le32_to_cpu(fc->offset);
+	c->starting_index = le16_to_cpu(fc->starting_index);
+	c->lpar = le16_to_cpu(fc->lpar);
+	c->domain = fc->domain;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	while (len) {
+		ssize_t r = write(fd, p, len);
+		if (r < 0) {
+			warn("write failure");
+			return -1;
+		}
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	while (len) {
+		ssize_t r = read(fd, p, len);
+		if (r <= 0)
+			return -1;
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+/* Check that an existing file was written with the same layout */
+static int header_matches(int fd, uint64_t catalog_version, const struct sample_file_column *cols,
+		size_t column_count, size_t block_size, off_t size)
+{
+	size_t cols_len = column_count * sizeof(*cols);
+	struct sample_file_header h;
+	int ret = -1;
+
+	void *have = malloc(cols_len);
+	if (!have && cols_len)
+		err(1, "alloc failure");
+
+	if (read_all(fd, &h, sizeof(h)) || memcmp(h.magic, SAMPLE_FILE_MAGIC, sizeof(h.magic))) {
+		warnx("not a sample file");
+		goto out;
+	}
+
+	if (le32_to_cpu(h.version) != SAMPLE_FILE_VERSION ||
+			le32_to_cpu(h.block_size) != block_size ||
+			le64_to_cpu(h.catalog_version) != catalog_version ||
+			le32_to_cpu(h.column_count) != column_count ||
+			read_all(fd, have, cols_len) || memcmp(have, cols, cols_len)) {
+		warnx("sample file has a different layout (version, block size, catalog version or columns)");
+		goto out;
+	}
+
+	if ((size - data_start(column_count, block_size)) % block_size) {
+		warnx("sample file ends with a partial block");
+		goto out;
+	}
+
+	ret = 0;
+out:
+	free(have);
+	return ret;
+}
+
+struct sample_writer *sample_writer_open(const char *file, uint64_t catalog_version,
+		const struct sample_column *columns, size_t column_count, size_t block_size)
+{
+	struct sample_writer *w;
+	struct stat st;
+	size_t i;
+
+	if (!block_size || (block_size & (block_size - 1))) {
+		warnx("block size must be a power of 2, got %zu", block_size);
+		return NULL;
+	}
+
+	if (block_header_len(column_count) + (column_count + 1) * VARINT_MAX > block_size) {
+		warnx("%zu columns don't fit in a %zu byte block", column_count, block_size);
+		return NULL;
+	}
+
+	struct sample_file_column *cols = calloc(column_count, sizeof(*cols));
+	if (!cols && column_count)
+		err(1, "alloc failure");
+	for (i = 0; i < column_count; i++)
+		column_to_file(&columns[i], &cols[i]);
+
+	int fd = open(file, O_RDWR | O_CREAT | O_APPEND, 0666);
+	if (fd == -1) {
+		warn("could not open %s", file);
+		goto err_cols;
+	}
+
+	if (fstat(fd, &st)) {
+		warn("could not stat %s", file);
+		goto err_close;
+	}
+
+	if (st.st_size) {
+		if (header_matches(fd, catalog_version, cols, column_count, block_size, st.st_size))
+			goto err_close;
+	} else {
+		size_t l = data_start(column_count, block_size);
+		unsigned char *h = calloc(1, l);
+		struct sample_file_header *fh = (void *)h;
+		if (!h)
+			err(1, "alloc failure");
+
+		memcpy(fh->magic, SAMPLE_FILE_MAGIC, sizeof(fh->magic));
+		fh->version = cpu_to_le32(SAMPLE_FILE_VERSION);
+		fh->block_size = cpu_to_le32(block_size);
+		fh->catalog_version = cpu_to_le64(catalog_version);
+		fh->column_count = cpu_to_le32(column_count);
+		memcpy(h + sizeof(*fh), cols, column_count * sizeof(*cols));
+
+		int r = write_all(fd, h, l);
+		free(h);
+		if (r)
+			goto err_close;
+	}
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		err(1, "alloc failure");
+	w->fd = fd;
+	w->block_size = block_size;
+	w->column_count = column_count;
+	w->data = calloc(column_count + 1, sizeof(*w->data));
+	w->len = calloc(column_count + 1, sizeof(*w->len));
+	w->prev = calloc(column_count + 1, sizeof(*w->prev));
+	w->min = calloc(column_count + 1, sizeof(*w->min));
+	w->max = calloc(column_count + 1, sizeof(*w->max));
+	w->block = malloc(block_size);
+	if (!w->data || !w->len || !w->prev || !w->min || !w->max || !w->block)
+		err(1, "alloc failure");
+	for (i = 0; i < column_count + 1; i++) {
+		/* no single column can outgrow the block */
+		w->data[i] = malloc(block_size);
+		if (!w->data[i])
+			err(1, "alloc failure");
+	}
+
+	free(cols);
+	return w;
+
+err_close:
+	close(fd);
+err_cols:
+	free(cols);
+	return NULL;
+}
+
+int sample_writer_flush(struct sample_writer *w)
+{
+	size_t ncol = w->column_count + 1;
+	size_t off = block_header_len(w->column_count);
+	struct sample_block_header *bh = (void *)w->block;
+	struct sample_block_column *bc = (void *)(w->block + sizeof(*bh));
+	size_t i;
+
+	if (!w->rows)
+		return 0;
+
+	memset(w->block, 0, w->block_size);
+	bh->magic = cpu_to_le32(SAMPLE_BLOCK_MAGIC);
+	bh->row_count = cpu_to_le32(w->rows);
+	bh->timebase_min = cpu_to_le64(w->min[0]);
+	bh->timebase_max = cpu_to_le64(w->max[0]);
+
+	for (i = 0; i < ncol; i++) {
+		bc[i].data_offset = cpu_to_le32(off);
+		bc[i].data_len = cpu_to_le32(w->len[i]);
+		bc[i].min = cpu_to_le64(w->min[i]);
+		bc[i].max = cpu_to_le64(w->max[i]);
+		memcpy(w->block + off, w->data[i], w->len[i]);
+		off += w->len[i];
+		w->len[i] = 0;
+	}
+
+	pr_debug(3, "block: %"PRIu32" rows, %zu bytes used", w->rows, off);
+
+	w->rows = 0;
+	w->data_len = 0;
+	return write_all(w->fd, w->block, w->block_size);
+}
+
+int sample_writer_append(struct sample_writer *w, uint64_t timebase, const uint64_t *values)
+{
+	size_t ncol = w->column_count + 1;
+	size_t i;
+
+	if (block_header_len(w->column_count) + w->data_len + ncol * VARINT_MAX > w->block_size)
+		if (sample_writer_flush(w))
+			return -1;
+
+	for (i = 0; i < ncol; i++) {
+		uint64_t v = i ? values[i - 1] : timebase;
+		/* the first value in a block is relative to 0 */
+		uint64_t prev = w->rows ? w->prev[i] : 0;
+		size_t n = varint_put(w->data[i] + w->len[i], zigzag((int64_t)(v - prev)));
+
+		w->len[i] += n;
+		w->data_len += n;
+		w->prev[i] = v;
+
+		if (!w->rows || v < w->min[i])
+			w->min[i] = v;
+		if (!w->rows || v > w->max[i])
+			w->max[i] = v;
+	}
+
+	w->rows++;
+	return 0;
+}
+
+int sample_writer_close(struct sample_writer *w)
+{
+	size_t i;
+	int ret = sample_writer_flush(w);
+
+	if (close(w->fd)) {
+		warn("close failure");
+		ret = -1;
+	}
+
+	for (i = 0; i < w->column_count + 1; i++)
+		free(w->data[i]);
+	free(w->data);
+	free(w->len);
+	free(w->prev);
+	free(w->min);
+	free(w->max);
+	free(w->block);
+	free(w);
+	return ret;
+}
+
+struct sample_reader {
+	unsigned char *map;
+	size_t map_len;
+
+	uint64_t catalog_version;
+	size_t block_size;
+	size_t column_count;
+	const struct sample_file_column *columns;
+
+	unsigned char *blocks;
+	size_t block_count;
+};
+
+struct sample_reader *sample_reader_open(const char *file)
+{
+	struct sample_reader *r;
+	struct stat st;
+
+	int fd = open(file, O_RDONLY);
+	if (fd == -1) {
+		warn("could not open %s", file);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(struct sample_file_header)) {
+		warnx("%s: too short to be a sample file", file);
+		close(fd);
+		return NULL;
+	}
+
+	void *m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) {
+		warn("could not map %s", file);
+		return NULL;
+	}
+
+	struct sample_file_header *h = m;
+	size_t block_size = le32_to_cpu(h->block_size);
+	size_t column_count = le32_to_cpu(h->column_count);
+	if (memcmp(h->magic, SAMPLE_FILE_MAGIC, sizeof(h->magic)) ||
+			le32_to_cpu(h->version) != SAMPLE_FILE_VERSION ||
+			!block_size || (block_size & (block_size - 1)) ||
+			block_header_len(column_count) > block_size ||
+			data_start(column_count, block_size) > (size_t)st.st_size) {
+		warnx("%s: not a (supported) sample file", file);
+		munmap(m, st.st_size);
+		return NULL;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		err(1, "alloc failure");
+	r->map = m;
+	r->map_len = st.st_size;
+	r->catalog_version = le64_to_cpu(h->catalog_version);
+	r->block_size = block_size;
+	r->column_count = column_count;
+	r->columns = (void *)(r->map + sizeof(*h));
+	r->blocks = r->map + data_start(column_count, block_size);
+	r->block_count = (r->map_len - data_start(column_count, block_size)) / block_size;
+	return r;
+}
+
+void sample_reader_close(struct sample_reader *r)
+{
+	munmap(r->map, r->map_len);
+	free(r);
+}
+
+uint64_t sample_reader_catalog_version(struct sample_reader *r)
+{
+	return r->catalog_version;
+}
+
+size_t sample_reader_columns(struct sample_reader *r, struct sample_column *columns, size_t max)
+{
+	size_t i;
+	for (i = 0; i < r->column_count && i < max; i++)
+		column_from_file(&r->columns[i], &columns[i]);
+	return r->column_count;
+}
+
+size_t sample_reader_block_count(struct sample_reader *r)
+{
+	return r->block_count;
+}
+
+/* Header fields are little endian, callers convert */
+const struct sample_block_header *sample_reader_block(struct sample_reader *r, size_t i,
+		const struct sample_block_column **columns)
+{
+	unsigned char *b = r->blocks + i * r->block_size;
+	*columns = (void *)(b + sizeof(struct sample_block_header));
+	return (void *)b;
+}
+
+/* Decode @rows values of one column into @out, spaced @stride apart */
+static int decode_column(struct sample_reader *r, const unsigned char *block,
+		const struct sample_block_column *bc, uint32_t rows,
+		uint64_t *out, size_t stride)
+{
+	size_t off = le32_to_cpu(bc->data_offset), len = le32_to_cpu(bc->data_len);
+	const unsigned char *p, *end;
+	uint64_t v = 0;
+	uint32_t i;
+
+	if (off > r->block_size || len > r->block_size - off)
+		return -1;
+
+	p = block + off;
+	end = p + len;
+	for (i = 0; i < rows; i++) {
+		uint64_t d;
+		size_t n = varint_get(p, end, &d);
+		if (!n)
+			return -1;
+		p += n;
+		v += unzigzag(d);
+		out[i * stride] = v;
+	}
+
+	return 0;
+}
+
+int sample_reader_scan(struct sample_reader *r, uint64_t t0, uint64_t t1,
+		const size_t *column_ixs, size_t column_ix_count,
+		sample_scan_fn fn, void *arg)
+{
+	size_t k = column_ixs ? column_ix_count : r->column_count;
+	/* every value takes at least one byte */
+	size_t max_rows = r->block_size;
+	size_t b, i;
+	int ret = 0;
+
+	for (i = 0; i < k; i++)
+		if (column_ixs && column_ixs[i] >= r->column_count) {
+			warnx("no column %zu", column_ixs[i]);
+			return -1;
+		}
+
+	uint64_t *tb = malloc(sizeof(*tb) * max_rows);
+	uint64_t *vals = malloc(sizeof(*vals) * max_rows * (k ? k : 1));
+	if (!tb || !vals)
+		err(1, "alloc failure");
+
+	for (b = 0; b < r->block_count && !ret; b++) {
+		const struct sample_block_column *bc;
+		const struct sample_block_header *bh = sample_reader_block(r, b, &bc);
+		const unsigned char *block = (const void *)bh;
+		uint32_t rows = le32_to_cpu(bh->row_count), row;
+
+		if (le32_to_cpu(bh->magic) != SAMPLE_BLOCK_MAGIC || rows > max_rows) {
+			warnx("block %zu is corrupt, skipping", b);
+			continue;
+		}
+
+		if (le64_to_cpu(bh->timebase_max) < t0 || le64_to_cpu(bh->timebase_min) > t1)
+			continue;
+
+		if (decode_column(r, block, &bc[0], rows, tb, 1))
+			goto corrupt;
+		for (i = 0; i < k; i++) {
+			size_t c = column_ixs ? column_ixs[i] : i;
+			if (decode_column(r, block, &bc[c + 1], rows, vals + i, k))
+				goto corrupt;
+		}
+
+		for (row = 0; row < rows && !ret; row++)
+			if (tb[row] >= t0 && tb[row] <= t1)
+				ret = fn(arg, tb[row], vals + row * k);
+		continue;
+
+corrupt:
+		warnx("block %zu has a corrupt column, skipping", b);
+	}
+
+	free(tb);
+	free(vals);
+	return ret;
+}
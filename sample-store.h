@@ -0,0 +1,122 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef SAMPLE_STORE_H_
+#define SAMPLE_STORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Columnar storage for collected counter samples.
+ *
+ * A file holds one timebase column and one column per counter, each counter
+ * identified by the catalog's event identity (domain, offset,
+ * starting_index, lpar) and the whole file by the catalog version.
+ *
+ * Rows are grouped into fixed size blocks (so the file can be mmap()ed and
+ * any block found directly). Within a block each column is stored on its
+ * own as zigzag deltas in varints, so monotonic counters sampled at a steady
+ * rate usually take a byte or two per value. Each block header records the
+ * timebase range and each column's min and max, letting scans skip blocks
+ * without decoding them.
+ *
+ * All integers in the file are little endian.
+ *
+ * File:
+ *	struct sample_file_header
+ *	struct sample_file_column[column_count]
+ *	(padding to block_size)
+ *	block[]
+ *
+ * Block (block_size bytes):
+ *	struct sample_block_header
+ *	struct sample_block_column[column_count + 1] (timebase first)
+ *	column data
+ *	(padding)
+ */
+
+#define SAMPLE_FILE_MAGIC "24x7SMPL"
+#define SAMPLE_FILE_VERSION 1
+#define SAMPLE_BLOCK_MAGIC 0x314b4c42 /* "BLK1" */
+#define SAMPLE_BLOCK_SIZE_DEFAULT 65536
+
+struct sample_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t block_size;
+	uint64_t catalog_version;
+	uint32_t column_count;
+	uint32_t reserved;
+} __attribute__((__packed__));
+
+struct sample_file_column {
+	uint32_t offset;
+	uint16_t starting_index;
+	uint16_t lpar;
+	uint8_t domain;
+	uint8_t reserved[7];
+} __attribute__((__packed__));
+
+struct sample_block_header {
+	uint32_t magic;
+	uint32_t row_count;
+	uint64_t timebase_min;
+	uint64_t timebase_max;
+} __attribute__((__packed__));
+
+struct sample_block_column {
+	/* from the start of the block */
+	uint32_t data_offset;
+	uint32_t data_len;
+	uint64_t min;
+	uint64_t max;
+} __attribute__((__packed__));
+
+struct sample_column {
+	unsigned domain;
+	uint32_t offset;
+	uint16_t starting_index;
+	uint16_t lpar;
+};
+
+struct sample_writer;
+struct sample_reader;
+
+/*
+ * Create @file, or append to it if it already exists (in which case the
+ * columns, catalog version and block size must match).
+ */
+struct sample_writer *sample_writer_open(const char *file, uint64_t catalog_version,
+		const struct sample_column *columns, size_t column_count, size_t block_size);
+int sample_writer_append(struct sample_writer *w, uint64_t timebase, const uint64_t *values);
+/* Write out the partially filled block, following rows start a new one */
+int sample_writer_flush(struct sample_writer *w);
+int sample_writer_close(struct sample_writer *w);
+
+struct sample_reader *sample_reader_open(const char *file);
+void sample_reader_close(struct sample_reader *r);
+
+uint64_t sample_reader_catalog_version(struct sample_reader *r);
+size_t sample_reader_columns(struct sample_reader *r, struct sample_column *columns, size_t max);
+size_t sample_reader_block_count(struct sample_reader *r);
+const struct sample_block_header *sample_reader_block(struct sample_reader *r, size_t i,
+		const struct sample_block_column **columns);
+
+/*
+ * Call @fn for each row with @t0 <= timebase <= @t1, in file order.
+ * @values holds the columns listed in @column_ixs (or every column when
+ * @column_ixs is NULL), and only those columns are decoded. A non-zero
+ * return from @fn stops the scan and is returned.
+ */
+typedef int (*sample_scan_fn)(void *arg, uint64_t timebase, const uint64_t *values);
+int sample_reader_scan(struct sample_reader *r, uint64_t t0, uint64_t t1,
+		const size_t *column_ixs, size_t column_ix_count,
+		sample_scan_fn fn, void *arg);
+
+#endif
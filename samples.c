@@ -0,0 +1,280 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/*
+ * Append to, scan and describe columnar sample files (see sample-store.h).
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/err/err.h>
+#include <ccan/endian/endian.h>
+
+#include "sample-store.h"
+#include "pmu-format.h"
+
+static void _usage(const char *p, int e)
+{
+	FILE *o = stderr;
+	fprintf(o,
+"usage: %s append [-b block_size] [-v catalog_version] <file> <column>...\n"
+"       %s scan [-s timebase] [-e timebase] <file> [<column index>...]\n"
+"       %s info <file>\n"
+"\n"
+"Columns are given as event identities, ie:\n"
+"  domain=0x2,offset=0x358,starting_index=3,lpar=0\n"
+"append reads rows of \"timebase value...\" from stdin, scan prints them.\n", p, p, p);
+	exit(e);
+}
+
+#define _PRGM_NAME "samples"
+#define PRGM_NAME  (argc?argv[0]:_PRGM_NAME)
+#define usage(argc, argv, e) _usage(PRGM_NAME, e)
+#define U(e) usage(argc, argv, e)
+
+static uint64_t parse_u64(const char *s, const char *what)
+{
+	char *end;
+	uint64_t v = strtoull(s, &end, 0);
+	if (*s == '\0' || *end)
+		errx(1, "invalid %s \"%s\"", what, s);
+	return v;
+}
+
+static bool term_is(const struct pmu_term *t, const char *name)
+{
+	return t->name_len == strlen(name) && !memcmp(t->name, name, t->name_len);
+}
+
+static void parse_column(const char *s, struct sample_column *c)
+{
+	struct pmu_term terms[8];
+	int n = pmu_alias_parse(s, strlen(s), terms, ARRAY_SIZE(terms));
+	int i;
+
+	if (n < 0 || (size_t)n > ARRAY_SIZE(terms))
+		errx(1, "could not parse column \"%s\"", s);
+
+	memset(c, 0, sizeof(*c));
+	for (i = 0; i < n; i++) {
+		struct pmu_term *t = &terms[i];
+		if (t->param)
+			errx(1, "column \"%s\": %.*s needs a value, not \"%.*s\"", s,
+					(int)t->name_len, t->name, (int)t->param_len, t->param);
+
+		if (term_is(t, "domain") && t->value <= UINT8_MAX)
+			c->domain = t->value;
+		else if (term_is(t, "offset") && t->value <= UINT32_MAX)
+			c->offset = t->value;
+		else if (term_is(t, "starting_index") && t->value <= UINT16_MAX)
+			c->starting_index = t->value;
+		else if (term_is(t, "lpar") && t->value <= UINT16_MAX)
+			c->lpar = t->value;
+		else
+			errx(1, "column \"%s\": unknown or out of range term %.*s", s,
+					(int)t->name_len, t->name);
+	}
+}
+
+static int cmd_append(int argc, char **argv)
+{
+	size_t block_size = SAMPLE_BLOCK_SIZE_DEFAULT;
+	uint64_t catalog_version = 0;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "b:v:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			block_size = parse_u64(optarg, "block size");
+			break;
+		case 'v':
+			catalog_version = parse_u64(optarg, "catalog version");
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (argc - optind < 2)
+		U(1);
+
+	const char *file = argv[optind++];
+	size_t column_count = argc - optind;
+	struct sample_column *columns = calloc(column_count, sizeof(*columns));
+	uint64_t *values = calloc(column_count, sizeof(*values));
+	if (!columns || !values)
+		err(1, "alloc failure");
+	for (i = 0; optind + i < argc; i++)
+		parse_column(argv[optind + i], &columns[i]);
+
+	struct sample_writer *w = sample_writer_open(file, catalog_version,
+			columns, column_count, block_size);
+	if (!w)
+		return 1;
+
+	char *line = NULL;
+	size_t line_len = 0, line_nr = 0, rows = 0;
+	while (getline(&line, &line_len, stdin) != -1) {
+		char *p = line, *end;
+		size_t c;
+
+		line_nr++;
+		uint64_t timebase = strtoull(p, &end, 0);
+		if (end == p) {
+			if (strspn(p, " \t\n") != strlen(p))
+				errx(1, "stdin:%zu: expected a timebase", line_nr);
+			continue;
+		}
+
+		for (c = 0; c < column_count; c++) {
+			p = end;
+			values[c] = strtoull(p, &end, 0);
+			if (end == p)
+				errx(1, "stdin:%zu: expected %zu values", line_nr, column_count);
+		}
+
+		if (sample_writer_append(w, timebase, values))
+			return 1;
+		rows++;
+	}
+
+	pr_debug(1, "appended %zu rows", rows);
+
+	free(line);
+	free(values);
+	free(columns);
+	return !!sample_writer_close(w);
+}
+
+static int print_row(void *arg, uint64_t timebase, const uint64_t *values)
+{
+	size_t i, n = *(size_t *)arg;
+	printf("%"PRIu64, timebase);
+	for (i = 0; i < n; i++)
+		printf(" %"PRIu64, values[i]);
+	putchar('\n');
+	return 0;
+}
+
+static int cmd_scan(int argc, char **argv)
+{
+	uint64_t t0 = 0, t1 = UINT64_MAX;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:e:h")) != -1) {
+		switch (opt) {
+		case 's':
+			t0 = parse_u64(optarg, "start timebase");
+			break;
+		case 'e':
+			t1 = parse_u64(optarg, "end timebase");
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (argc - optind < 1)
+		U(1);
+
+	struct sample_reader *r = sample_reader_open(argv[optind++]);
+	if (!r)
+		return 1;
+
+	size_t n = argc - optind, i;
+	size_t *ixs = NULL;
+	if (n) {
+		ixs = calloc(n, sizeof(*ixs));
+		if (!ixs)
+			err(1, "alloc failure");
+		for (i = 0; i < n; i++)
+			ixs[i] = parse_u64(argv[optind + i], "column index");
+	} else {
+		n = sample_reader_columns(r, NULL, 0);
+	}
+
+	int ret = sample_reader_scan(r, t0, t1, ixs, n, print_row, &n);
+
+	free(ixs);
+	sample_reader_close(r);
+	return !!ret;
+}
+
+static int cmd_info(int argc, char **argv)
+{
+	if (argc != 2)
+		U(1);
+
+	struct sample_reader *r = sample_reader_open(argv[1]);
+	if (!r)
+		return 1;
+
+	size_t n = sample_reader_columns(r, NULL, 0), i;
+	struct sample_column *columns = calloc(n, sizeof(*columns));
+	if (!columns && n)
+		err(1, "alloc failure");
+	sample_reader_columns(r, columns, n);
+
+	printf("catalog_version: %"PRIu64"\n", sample_reader_catalog_version(r));
+	for (i = 0; i < n; i++)
+		printf("column %zu: domain=0x%x,offset=0x%"PRIx32",starting_index=%u,lpar=%u\n",
+				i, columns[i].domain, columns[i].offset,
+				columns[i].starting_index, columns[i].lpar);
+
+	size_t blocks = sample_reader_block_count(r);
+	for (i = 0; i < blocks; i++) {
+		const struct sample_block_column *bc;
+		const struct sample_block_header *bh = sample_reader_block(r, i, &bc);
+		size_t c, used = 0;
+		for (c = 0; c < n + 1; c++)
+			used += le32_to_cpu(bc[c].data_len);
+		printf("block %zu: %"PRIu32" rows, timebase %"PRIu64"-%"PRIu64", %zu data bytes\n",
+				i, le32_to_cpu(bh->row_count),
+				le64_to_cpu(bh->timebase_min), le64_to_cpu(bh->timebase_max), used);
+	}
+
+	free(columns);
+	sample_reader_close(r);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	err_set_progname(PRGM_NAME);
+
+	if (argc < 2)
+		U(1);
+
+	/* let each command's getopt see its own options */
+	const char *cmd = argv[1];
+	argv[1] = argv[0];
+	argc--;
+	argv++;
+
+	if (!strcmp(cmd, "append"))
+		return cmd_append(argc, argv);
+	if (!strcmp(cmd, "scan"))
+		return cmd_scan(argc, argv);
+	if (!strcmp(cmd, "info"))
+		return cmd_info(argc, argv);
+	if (!strcmp(cmd, "-h"))
+		U(0);
+	U(1);
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2014 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+/*
+ * Follow a catalog as it changes. Reader threads continuously look events
+ * up in the current snapshot (as collection threads would) while the
+ * catalog is reloaded underneath them.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <ccan/pr_debug/pr_debug.h>
+#include <ccan/err/err.h>
+
+#include "catalog-watch.h"
+
+struct reader_thread {
+	pthread_t thread;
+	struct catalog_watch *w;
+	uint64_t lookups;
+};
+
+static bool stop;
+
+static void *reader(void *arg)
+{
+	struct reader_thread *t = arg;
+	struct catalog_reader *r = catalog_reader_register(t->w);
+	size_t i = 0;
+
+	if (!r)
+		errx(1, "out of reader slots");
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		const struct catalog_snapshot *s = catalog_reader_lock(r);
+		struct catalog *c = (struct catalog *)&s->catalog;
+		if (c->event_count) {
+			size_t nl;
+			struct catalog_event *ev = &c->events[i++ % c->event_count];
+			const char *name = event_name(ev->data, &nl);
+			if (catalog_find_event(c, name, nl) != ev)
+				errx(1, "lookup of %.*s failed", (int)nl, name);
+		}
+		catalog_reader_unlock(r);
+		t->lookups++;
+	}
+
+	catalog_reader_unregister(r);
+	return NULL;
+}
+
+static void _usage(const char *p, int e)
+{
+	FILE *o = stderr;
+	fprintf(o,
+"usage: %s [-i interval_ms] [-r readers] [-t seconds] [-v version file] <catalog file>\n"
+"\n"
+"Print the catalog version and event count whenever the catalog changes.\n"
+"On a machine with kernel support, use:\n"
+"  -v /sys/bus/event_source/devices/hv_24x7/interface/catalog_version\n"
+"     /sys/bus/event_source/devices/hv_24x7/interface/catalog\n", p);
+	exit(e);
+}
+
+#define _PRGM_NAME "catalog-watch"
+#define PRGM_NAME  (argc?argv[0]:_PRGM_NAME)
+#define usage(argc, argv, e) _usage(PRGM_NAME, e)
+#define U(e) usage(argc, argv, e)
+
+int main(int argc, char **argv)
+{
+	const char *version_file = NULL;
+	unsigned interval_ms = 1000, reader_count = 1, i;
+	long seconds = 0;
+	int opt;
+
+	err_set_progname(PRGM_NAME);
+
+	while ((opt = getopt(argc, argv, "i:r:t:v:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			reader_count = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtol(optarg, NULL, 0);
+			break;
+		case 'v':
+			version_file = optarg;
+			break;
+		case 'h':
+			U(0);
+		default:
+			U(1);
+		}
+	}
+
+	if (argc - optind != 1)
+		U(1);
+
+	/* one extra slot for the main thread */
+	struct catalog_watch *w = catalog_watch_start(argv[optind], version_file,
+			interval_ms, reader_count + 1);
+	if (!w)
+		return 1;
+
+	struct reader_thread *threads = calloc(reader_count, sizeof(*threads));
+	if (!threads && reader_count)
+		err(1, "alloc failure");
+	for (i = 0; i < reader_count; i++) {
+		threads[i].w = w;
+		int r = pthread_create(&threads[i].thread, NULL, reader, &threads[i]);
+		if (r) {
+			errno = r;
+			err(1, "could not create reader thread");
+		}
+	}
+
+	struct catalog_reader *r = catalog_reader_register(w);
+	uint64_t last = 0;
+	long elapsed;
+	for (elapsed = 0; !seconds || elapsed < seconds; elapsed++) {
+		const struct catalog_snapshot *s = catalog_reader_lock(r);
+		if (s->version != last || !elapsed) {
+			printf("version %"PRIu64": %zu events\n", s->version, s->catalog.event_count);
+			fflush(stdout);
+			last = s->version;
+		}
+		catalog_reader_unlock(r);
+		sleep(1);
+	}
+	catalog_reader_unregister(r);
+
+	__atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+	uint64_t lookups = 0;
+	for (i = 0; i < reader_count; i++) {
+		pthread_join(threads[i].thread, NULL);
+		lookups += threads[i].lookups;
+	}
+	pr_debug(1, "%"PRIu64" lookups", lookups);
+
+	free(threads);
+	catalog_watch_stop(w);
+	return 0;
+}